@@ -0,0 +1,579 @@
+#include "s4c_gui.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Renders synthetic widgets on a headless terminal and reports, per frame:
+ *  - render time
+ *  - allocations (all of them on glibc, only s4c_gui's own elsewhere)
+ *  - bytes emitted to the terminal
+ */
+
+static size_t bench_allocs = 0;
+
+#ifdef __GLIBC__
+// Interpose the allocator so ncurses allocations are counted too
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size)
+{
+    bench_allocs++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    bench_allocs++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    bench_allocs++;
+    return __libc_realloc(ptr, size);
+}
+#else
+static void* bench_malloc(size_t size)
+{
+    bench_allocs++;
+    return malloc(size);
+}
+
+static void* bench_calloc(size_t count, size_t size)
+{
+    bench_allocs++;
+    return calloc(count, size);
+}
+#endif
+
+#define BENCH_ROWS 50
+#define BENCH_COLS 160
+#define BENCH_LABEL_SIZE 24
+
+/*
+ * Max p99 input to screen latency of the replay case, past which the bench exits with 1.
+ * The S4C_GUI_BENCH_P99_MAX_USECS environment variable overrides it, 0 for no limit.
+ */
+#ifndef BENCH_P99_MAX_USECS
+#define BENCH_P99_MAX_USECS 50000
+#endif // !BENCH_P99_MAX_USECS
+
+static bool bench_failed = false; // A case went past its limit
+
+typedef struct Bench_Sample {
+    double usecs;
+    size_t allocs;
+    size_t bytes;
+} Bench_Sample;
+
+typedef struct Bench_Probe {
+    struct timespec start;
+    size_t allocs;
+    size_t bytes;
+} Bench_Probe;
+
+static Bench_Probe bench_start(S4C_Gui_Term* term)
+{
+    Bench_Probe res = {0};
+    res.allocs = bench_allocs;
+    res.bytes = get_S4C_Gui_Term_bytes(term);
+    clock_gettime(CLOCK_MONOTONIC, &res.start);
+    return res;
+}
+
+static Bench_Sample bench_stop(S4C_Gui_Term* term, Bench_Probe probe, int frames)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (frames < 1) frames = 1;
+    double usecs = (end.tv_sec - probe.start.tv_sec) * 1e6 + (end.tv_nsec - probe.start.tv_nsec) / 1e3;
+    return (Bench_Sample) {
+        .usecs = usecs / frames,
+        .allocs = (bench_allocs - probe.allocs) / frames,
+        .bytes = (get_S4C_Gui_Term_bytes(term) - probe.bytes) / frames,
+    };
+}
+
+static void bench_report(const char* name, int size, Bench_Sample sample)
+{
+    fprintf(stdout, "%-32s %8i %12.2f %10zu %10zu\n", name, size, sample.usecs, sample.allocs, sample.bytes);
+}
+
+static Toggle* bench_toggles(int num_toggles, char** labels)
+{
+    Toggle* res = calloc(num_toggles, sizeof(Toggle));
+    *labels = calloc(num_toggles, BENCH_LABEL_SIZE);
+    for (int i = 0; i < num_toggles; i++) {
+        char* label = (*labels) + (i * BENCH_LABEL_SIZE);
+        snprintf(label, BENCH_LABEL_SIZE, "Toggle #%i", i);
+        res[i].label = label;
+        if (i % 2 == 0) {
+            res[i].type = BOOL_TOGGLE;
+            res[i].state.bool_state = (i % 4 == 0);
+        } else {
+            res[i].type = MULTI_STATE_TOGGLE;
+            res[i].state.ts_state.num_states = 3;
+        }
+    }
+    return res;
+}
+
+/*
+ * Writes the keys to a fresh input file for the terminal, rewound and ready to be read.
+ */
+static FILE* bench_input(const char* keys, size_t len)
+{
+    FILE* res = tmpfile();
+    if (res == NULL) return NULL;
+    fwrite(keys, 1, len, res);
+    fflush(res);
+    rewind(res);
+    return res;
+}
+
+static void bench_state_window(int num_toggles)
+{
+    FILE* out = tmpfile();
+    S4C_Gui_Term* term = new_S4C_Gui_Term_headless(NULL, out, NULL, BENCH_ROWS, BENCH_COLS);
+    char* labels = NULL;
+    Toggle* toggles = bench_toggles(num_toggles, &labels);
+    ToggleMenu toggle_menu = new_ToggleMenu_virtualized(toggles, num_toggles, BENCH_ROWS, 0);
+    toggle_menu.statewin_boxed = true;
+    WINDOW* win = newwin(BENCH_ROWS, BENCH_COLS / 2, 0, BENCH_COLS / 2);
+
+    Bench_Probe probe = bench_start(term);
+    draw_ToggleMenu_states(win, toggle_menu);
+    bench_report("state window: full paint", num_toggles, bench_stop(term, probe, 1));
+
+    const int frames = 1000;
+    const int rows = (num_toggles < BENCH_ROWS - 2 ? num_toggles : BENCH_ROWS - 2);
+    probe = bench_start(term);
+    for (int i = 0; i < frames; i++) {
+        int target = (i * 7) % rows;
+        toggles[target].state.bool_state = !toggles[target].state.bool_state;
+        mark_ToggleMenu_dirty(toggle_menu, target);
+        draw_ToggleMenu_dirty_states(win, toggle_menu);
+        doupdate();
+    }
+    bench_report("state window: one dirty row", num_toggles, bench_stop(term, probe, frames));
+
+    delwin(win);
+    free_ToggleMenu(toggle_menu);
+    free_S4C_Gui_Term(term);
+    fclose(out);
+    free(toggles);
+    free(labels);
+}
+
+static void bench_handle_menu(int num_toggles, bool virtualized)
+{
+    // Scroll through a few pages, flip a toggle on the way, then quit
+    const int moves = 200;
+    char keys[512];
+    size_t len = 0;
+    for (int i = 0; i < moves; i++) {
+        keys[len++] = 'j';
+        if (i % 20 == 0) keys[len++] = '\n';
+    }
+    keys[len++] = 'q';
+
+    FILE* out = tmpfile();
+    FILE* in = bench_input(keys, len);
+    S4C_Gui_Term* term = new_S4C_Gui_Term_headless(NULL, out, in, BENCH_ROWS, BENCH_COLS);
+    char* labels = NULL;
+    Toggle* toggles = bench_toggles(num_toggles, &labels);
+    ToggleMenu toggle_menu = {0};
+    Bench_Probe probe = bench_start(term);
+    if (virtualized) {
+        toggle_menu = new_ToggleMenu_virtualized(toggles, num_toggles, BENCH_ROWS - 2, 0);
+    } else {
+        toggle_menu = new_ToggleMenu(toggles, num_toggles);
+    }
+    bench_report((virtualized ? "virtual menu: build" : "menu: build"), num_toggles, bench_stop(term, probe, 1));
+    toggle_menu.statewin_height = BENCH_ROWS;
+    toggle_menu.statewin_width = BENCH_COLS / 2;
+    toggle_menu.statewin_start_x = BENCH_COLS / 2;
+    toggle_menu.statewin_boxed = true;
+    toggle_menu.key_down = 'j';
+    toggle_menu.quit_key = 'q';
+
+    probe = bench_start(term);
+    ToggleMenu_Session session = new_ToggleMenu_Session(toggle_menu);
+    open_ToggleMenu_Session(session);
+    bench_report((virtualized ? "virtual menu: open" : "menu: open"), num_toggles, bench_stop(term, probe, 1));
+
+    probe = bench_start(term);
+    handle_ToggleMenu_Session(session);
+    bench_report((virtualized ? "virtual menu: per key" : "menu: per key"), num_toggles, bench_stop(term, probe, len));
+
+    free_ToggleMenu_Session(session);
+    free_ToggleMenu(toggle_menu);
+    free_S4C_Gui_Term(term);
+    fclose(in);
+    fclose(out);
+    free(toggles);
+    free(labels);
+}
+
+static void bench_report_output_stats(void)
+{
+    static const char* widgets[S4C_GUI_WIDGET_MAX+1] = { "other", "textfield", "menu", "state window", "textarea" };
+    S4C_Gui_Output_Stats stats = get_s4c_gui_output_stats();
+    fprintf(stdout, "%-32s %10s %10s %10s %8s %8s %8s\n", "widget", "refreshes", "bytes", "escapes", "clears", "boxes", "prints");
+    for (int i = 0; i <= S4C_GUI_WIDGET_MAX; i++) {
+        S4C_Gui_Widget_Stats w = stats.widgets[i];
+        fprintf(stdout, "%-32s %10zu %10zu %10zu %8zu %8zu %8zu\n", widgets[i], w.refreshes, w.bytes, w.escapes,
+                w.ops[S4C_GUI_OP_CLEAR], w.ops[S4C_GUI_OP_BOX], w.ops[S4C_GUI_OP_PRINT]);
+    }
+    fprintf(stdout, "%-32s %10zu %10zu %10zu\n", (stats.bytes_measured ? "total" : "total (bytes not measured)"),
+            stats.refreshes, stats.bytes, stats.escapes);
+    fprintf(stdout, "%-32s %10zu\n", "deferred by the frame rate cap", stats.deferred);
+}
+
+static void bench_mouse_motion(int num_toggles)
+{
+    // Sweep the pointer over the menu rows, then click one and quit
+    const int events = 1000;
+    const size_t event_size = 32;
+    char* keys = calloc(events + 2, event_size);
+    size_t len = 0;
+    for (int i = 0; i < events; i++) {
+        len += snprintf(keys + len, event_size, "\033[<35;%i;%iM", 3, 2 + (i % (BENCH_ROWS - 2)));
+    }
+    len += snprintf(keys + len, event_size, "\033[<0;3;2M\033[<0;3;2m");
+    len += snprintf(keys + len, event_size, "q");
+
+    FILE* out = tmpfile();
+    FILE* in = bench_input(keys, len);
+    S4C_Gui_Term* term = new_S4C_Gui_Term_headless(NULL, out, in, BENCH_ROWS, BENCH_COLS);
+    char* labels = NULL;
+    Toggle* toggles = bench_toggles(num_toggles, &labels);
+    ToggleMenu toggle_menu = new_ToggleMenu_virtualized(toggles, num_toggles, BENCH_ROWS, 0);
+    toggle_menu.statewin_height = BENCH_ROWS;
+    toggle_menu.statewin_width = BENCH_COLS / 2;
+    toggle_menu.statewin_start_x = BENCH_COLS / 2;
+    toggle_menu.get_mouse_events = true;
+    toggle_menu.mouse_events_mask = ALL_MOUSE_EVENTS | REPORT_MOUSE_POSITION;
+    toggle_menu.quit_key = 'q';
+
+    Bench_Probe probe = bench_start(term);
+    handle_ToggleMenu(toggle_menu);
+    bench_report("virtual menu: per mouse event", num_toggles, bench_stop(term, probe, events + 2));
+
+    free_ToggleMenu(toggle_menu);
+    free_S4C_Gui_Term(term);
+    fclose(in);
+    fclose(out);
+    free(toggles);
+    free(labels);
+    free(keys);
+}
+
+static void bench_label_search(int num_toggles)
+{
+    // Narrow down to one label, step through the matches of a shorter query, then quit
+    const char keys[] = "/t9999\b\b\t\t\t\b\b\b\b\nq";
+    const size_t len = sizeof(keys) - 1;
+
+    FILE* out = tmpfile();
+    FILE* in = bench_input(keys, len);
+    S4C_Gui_Term* term = new_S4C_Gui_Term_headless(NULL, out, in, BENCH_ROWS, BENCH_COLS);
+    char* labels = NULL;
+    Toggle* toggles = bench_toggles(num_toggles, &labels);
+
+    ToggleMenu toggle_menu = new_ToggleMenu_virtualized(toggles, num_toggles, BENCH_ROWS, 0);
+    toggle_menu.quit_key = 'q';
+
+    // The index is built by the first search
+    Bench_Probe probe = bench_start(term);
+    find_ToggleMenu_label(toggle_menu, "", 0);
+    bench_report("search: build index", num_toggles, bench_stop(term, probe, 1));
+
+    probe = bench_start(term);
+    handle_ToggleMenu(toggle_menu);
+    bench_report("search: per key", num_toggles, bench_stop(term, probe, len));
+
+    free_ToggleMenu(toggle_menu);
+    free_S4C_Gui_Term(term);
+    fclose(in);
+    fclose(out);
+    free(toggles);
+    free(labels);
+}
+
+static void bench_state_restore(int num_toggles)
+{
+    char path[] = "/tmp/s4c_gui_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return;
+    close(fd);
+    FILE* out = tmpfile();
+    S4C_Gui_Term* term = new_S4C_Gui_Term_headless(NULL, out, NULL, BENCH_ROWS, BENCH_COLS);
+    char* labels = NULL;
+    Toggle* toggles = bench_toggles(num_toggles, &labels);
+    ToggleMenu toggle_menu = new_ToggleMenu_virtualized(toggles, num_toggles, BENCH_ROWS, 0);
+    for (int i = 0; i < num_toggles; i++) {
+        if (toggles[i].type == BOOL_TOGGLE) toggles[i].state.bool_state = !toggles[i].state.bool_state;
+        if (toggles[i].type == MULTI_STATE_TOGGLE) toggles[i].state.ts_state.current_state = i % 3;
+        toggles[i].locked = (i % 5 == 0);
+    }
+
+    Bench_Probe probe = bench_start(term);
+    save_ToggleMenu_state(toggle_menu, path);
+    bench_report("state: save", num_toggles, bench_stop(term, probe, 1));
+
+    // Restore over the initial states, so every toggle changes
+    for (int i = 0; i < num_toggles; i++) {
+        if (toggles[i].type == BOOL_TOGGLE) toggles[i].state.bool_state = !toggles[i].state.bool_state;
+        if (toggles[i].type == MULTI_STATE_TOGGLE) toggles[i].state.ts_state.current_state = (i + 1) % 3;
+        toggles[i].locked = false;
+    }
+    probe = bench_start(term);
+    restore_ToggleMenu_state(toggle_menu, path);
+    bench_report("state: restore", num_toggles, bench_stop(term, probe, 1));
+
+    unlink(path);
+    free_ToggleMenu(toggle_menu);
+    free_S4C_Gui_Term(term);
+    fclose(out);
+    free(toggles);
+    free(labels);
+}
+
+static void bench_menu_load(int num_toggles)
+{
+    // A generated description: mostly bools and multi states, a TextField every 1000 toggles
+    FILE* in = tmpfile();
+    for (int i = 0; i < num_toggles; i++) {
+        if (i % 1000 == 999) {
+            fprintf(in, "text 32 Field #%i\n", i);
+        } else if (i % 2 == 0) {
+            fprintf(in, "bool %s Toggle #%i\n", ((i % 4 == 0) ? "on" : "off"), i);
+        } else {
+            fprintf(in, "multi %i/3%s Toggle #%i\n", i % 3, ((i % 5 == 0) ? " locked" : ""), i);
+        }
+    }
+    rewind(in);
+    FILE* out = tmpfile();
+    S4C_Gui_Term* term = new_S4C_Gui_Term_headless(NULL, out, NULL, BENCH_ROWS, BENCH_COLS);
+
+    Bench_Probe probe = bench_start(term);
+    // Sized for the whole menu, so the arena block is the only allocation: TextField windows wait for a draw
+    S4C_Gui_Arena* arena = new_S4C_Gui_Arena((size_t) num_toggles * 128);
+    int loaded = 0;
+    Toggle* toggles = load_ToggleMenu_toggles(in, arena, 3, BENCH_COLS, 0, 0, &loaded, NULL);
+    bench_report("loader: whole menu", num_toggles, bench_stop(term, probe, 1));
+
+    if (toggles != NULL) {
+        ToggleMenu toggle_menu = new_ToggleMenu_virtualized(toggles, loaded, BENCH_ROWS, 0);
+        free_ToggleMenu(toggle_menu);
+    }
+    free_S4C_Gui_Arena(arena);
+    free_S4C_Gui_Term(term);
+    fclose(in);
+    fclose(out);
+}
+
+static void bench_update_queue(int num_toggles)
+{
+    // Post one update per toggle, as worker threads would, then apply them on the UI side
+    FILE* out = tmpfile();
+    S4C_Gui_Term* term = new_S4C_Gui_Term_headless(NULL, out, NULL, BENCH_ROWS, BENCH_COLS);
+    char* labels = NULL;
+    Toggle* toggles = bench_toggles(num_toggles, &labels);
+    ToggleMenu toggle_menu = new_ToggleMenu_virtualized(toggles, num_toggles, BENCH_ROWS, 0);
+    toggle_menu.updates = new_ToggleMenu_UpdateQueue(num_toggles);
+
+    Bench_Probe probe = bench_start(term);
+    for (int i = 0; i < num_toggles; i++) {
+        if (toggles[i].type == BOOL_TOGGLE) {
+            post_ToggleMenu_bool(toggle_menu.updates, i, !toggles[i].state.bool_state);
+        } else {
+            post_ToggleMenu_multi(toggle_menu.updates, i, 2);
+        }
+    }
+    bench_report("updates: per post", num_toggles, bench_stop(term, probe, num_toggles));
+    probe = bench_start(term);
+    apply_ToggleMenu_updates(toggle_menu);
+    bench_report("updates: per applied", num_toggles, bench_stop(term, probe, num_toggles));
+
+    free_ToggleMenu_UpdateQueue(toggle_menu.updates);
+    free_ToggleMenu(toggle_menu);
+    free_S4C_Gui_Term(term);
+    fclose(out);
+    free(toggles);
+    free(labels);
+}
+
+static void bench_replay_latency(int num_toggles)
+{
+    char path[] = "/tmp/s4c_gui_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return;
+    close(fd);
+    // A session over the demo's toggle kinds, scaled up: scroll, flip toggles, edit text, then quit
+    const int moves = 300;
+    char keys[1024];
+    size_t len = 0;
+    for (int i = 0; i < moves; i++) {
+        keys[len++] = 'j';
+        if (i % 25 == 0) keys[len++] = '\n';
+    }
+    len += snprintf(keys + len, sizeof(keys) - len, "\nedited\nq");
+
+    for (int replay = 0; replay < 2; replay++) {
+        FILE* out = tmpfile();
+        FILE* in = bench_input(keys, (replay ? 0 : len));
+        S4C_Gui_Term* term = new_S4C_Gui_Term_headless(NULL, out, in, BENCH_ROWS, BENCH_COLS);
+        char* labels = NULL;
+        Toggle* toggles = bench_toggles(num_toggles, &labels);
+        // The toggle the moves end on takes the text
+        toggles[moves].type = TEXTFIELD_TOGGLE;
+        toggles[moves].state.txt_state = new_TextField(16, 3, BENCH_COLS / 2, BENCH_ROWS - 3, 0);
+        ToggleMenu toggle_menu = new_ToggleMenu_virtualized(toggles, num_toggles, BENCH_ROWS - 2, 0);
+        toggle_menu.statewin_height = BENCH_ROWS;
+        toggle_menu.statewin_width = BENCH_COLS / 2;
+        toggle_menu.statewin_start_x = BENCH_COLS / 2;
+        toggle_menu.statewin_boxed = true;
+        toggle_menu.key_down = 'j';
+        toggle_menu.quit_key = 'q';
+
+        if (!replay) {
+            start_s4c_gui_recording(path);
+            handle_ToggleMenu(toggle_menu);
+            stop_s4c_gui_recording();
+        } else if (start_s4c_gui_replay(path, false)) {
+            Bench_Probe probe = bench_start(term);
+            handle_ToggleMenu(toggle_menu);
+            S4C_Gui_Replay_Stats stats = get_s4c_gui_replay_stats();
+            Bench_Sample sample = bench_stop(term, probe, stats.events);
+            bench_report("replay: per event", num_toggles, sample);
+            sample.usecs = stats.p50_usecs;
+            bench_report("replay: p50 input to screen", num_toggles, sample);
+            sample.usecs = stats.p99_usecs;
+            bench_report("replay: p99 input to screen", num_toggles, sample);
+            const char* max_env = getenv("S4C_GUI_BENCH_P99_MAX_USECS");
+            long long max_usecs = (max_env != NULL ? atoll(max_env) : BENCH_P99_MAX_USECS);
+            if (max_usecs > 0 && stats.p99_usecs > max_usecs) {
+                fprintf(stderr, "replay: p99 input to screen of %lli usecs is over the %lli usecs limit\n", stats.p99_usecs, max_usecs);
+                bench_failed = true;
+            }
+            stop_s4c_gui_replay();
+        }
+
+        free_ToggleMenu(toggle_menu);
+        free_S4C_Gui_Term(term);
+        fclose(in);
+        fclose(out);
+        free(toggles);
+        free(labels);
+    }
+    unlink(path);
+}
+
+static void bench_textfield_input(int input_len)
+{
+    char* keys = calloc(input_len + 2, 1);
+    for (int i = 0; i < input_len; i++) {
+        keys[i] = 'a' + (i % 26);
+    }
+    keys[input_len] = '\n';
+
+    FILE* out = tmpfile();
+    FILE* in = bench_input(keys, input_len + 1);
+    S4C_Gui_Term* term = new_S4C_Gui_Term_headless(NULL, out, in, BENCH_ROWS, BENCH_COLS);
+    TextField txt_field = new_TextField(input_len, 3, BENCH_COLS, 0, 0);
+    Bench_Probe probe = bench_start(term);
+    use_clean_TextField(txt_field);
+    bench_report("textfield: per key", input_len, bench_stop(term, probe, input_len + 1));
+
+    free_TextField(txt_field);
+    free_S4C_Gui_Term(term);
+    fclose(in);
+    fclose(out);
+    free(keys);
+}
+
+static void bench_textarea_paste(int input_len)
+{
+    // Paste lines of a log in front of a loaded text, then end input
+    static const char loaded[] = "first line\nlast line\n";
+    char* keys = calloc(input_len + 1, 1);
+    for (int i = 0; i < input_len; i++) {
+        keys[i] = ((i % 40 == 39) ? '\n' : 'a' + (i % 26));
+    }
+    keys[input_len] = TEXTAREA_DONE_KEY;
+
+    FILE* out = tmpfile();
+    FILE* in = bench_input(keys, input_len + 1);
+    S4C_Gui_Term* term = new_S4C_Gui_Term_headless(NULL, out, in, BENCH_ROWS, BENCH_COLS);
+    TextArea area = new_TextArea(input_len + sizeof(loaded), BENCH_ROWS, BENCH_COLS, 0, 0);
+    set_TextArea_text(area, loaded, sizeof(loaded) - 1);
+    Bench_Probe probe = bench_start(term);
+    use_clean_TextArea(area);
+    bench_report("textarea: per pasted key", input_len, bench_stop(term, probe, input_len + 1));
+
+    free_TextArea(area);
+    free_S4C_Gui_Term(term);
+    fclose(in);
+    fclose(out);
+    free(keys);
+}
+
+int main(void)
+{
+#ifndef __GLIBC__
+    s4c_gui_inner_malloc = &bench_malloc;
+    s4c_gui_inner_calloc = &bench_calloc;
+#endif
+    const int sizes[] = { 10, 100, 1000, 10000, 100000 };
+    const int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    fprintf(stdout, "s4c-gui v%s bench, %ix%i headless terminal\n", string_s4c_gui_version(), BENCH_ROWS, BENCH_COLS);
+    fprintf(stdout, "%-32s %8s %12s %10s %10s\n", "case", "size", "usecs/frame", "allocs", "bytes");
+    for (int i = 0; i < num_sizes; i++) {
+        bench_state_window(sizes[i]);
+    }
+    for (int i = 0; i < num_sizes; i++) {
+        bench_handle_menu(sizes[i], true);
+    }
+    for (int i = 0; i < num_sizes; i++) {
+        // One ITEM per toggle: keep the MENU-backed case small enough to finish quickly
+        if (sizes[i] <= 10000) bench_handle_menu(sizes[i], false);
+    }
+    bench_mouse_motion(1000);
+    for (int i = 0; i < num_sizes; i++) {
+        bench_label_search(sizes[i]);
+    }
+    bench_state_restore(50000);
+    bench_menu_load(10000);
+    bench_menu_load(100000);
+    bench_update_queue(10000);
+    bench_replay_latency(10000);
+    bench_textfield_input(64);
+    bench_textfield_input(4096);
+    bench_textarea_paste(4096);
+    bench_textarea_paste(65536);
+
+    // Every flush sent right away, as when the terminal keeps up with the keys
+    fprintf(stdout, "\nNo frame rate cap\n");
+    set_s4c_gui_max_fps(0);
+    bench_handle_menu(10000, true);
+    bench_textfield_input(4096);
+    bench_textarea_paste(4096);
+    set_s4c_gui_max_fps(S4C_GUI_MAX_FPS);
+
+    // Accounting reads back every byte sent, so it's kept out of the timings above
+    fprintf(stdout, "\nOutput by widget: menu with 1000 toggles, then a 64 chars textfield\n");
+    enable_s4c_gui_output_stats(true);
+    reset_s4c_gui_output_stats();
+    bench_handle_menu(1000, true);
+    bench_textfield_input(64);
+    bench_report_output_stats();
+    enable_s4c_gui_output_stats(false);
+    return (bench_failed ? 1 : 0);
+}
@@ -26,6 +26,7 @@ int textfield_main(void)
     char* prompt = "Start typing";
 
     TextField txt_field = new_TextField_centered_(&warn_TextField, my_linters, n_linters, linter_args, max_size, height, width, COLS, LINES, prompt, S4C_GUI_MALLOC, S4C_GUI_CALLOC, NULL);
+    enable_TextField_live_lint(txt_field, &show_TextField_lint);
 
     use_clean_TextField(txt_field);
 
@@ -66,6 +67,15 @@ const char* my_format(int val)
     }
 }
 
+void place_togglemenu_statewin(ToggleMenu* toggle_menu)
+{
+    // Keep the state window on the right half of the screen
+    toggle_menu->statewin_height = LINES;
+    toggle_menu->statewin_width = COLS/2;
+    toggle_menu->statewin_start_x = COLS/2;
+    toggle_menu->statewin_start_y = 0;
+}
+
 int togglemenu_main(size_t argc, char** argv)
 {
     // Initialize ncurses
@@ -104,10 +114,8 @@ int togglemenu_main(size_t argc, char** argv)
     } else {
         toggle_menu = new_ToggleMenu(toggles, num_toggles);
     }
-    toggle_menu.statewin_height = LINES;
-    toggle_menu.statewin_width = COLS/2;
-    toggle_menu.statewin_start_x = COLS/2;
-    toggle_menu.statewin_start_y = 0;
+    place_togglemenu_statewin(&toggle_menu);
+    toggle_menu.resize_handler = &place_togglemenu_statewin;
     toggle_menu.statewin_boxed = true;
     toggle_menu.statewin_label = sidewin_label;
     toggle_menu.key_up = 'j';
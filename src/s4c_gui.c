@@ -15,7 +15,32 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // For posix_openpt() and friends, used by metered terminals
+#endif
 #include "s4c_gui.h"
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h> // lseek() on the outputs of terminals from new_S4C_Gui_Term_headless()
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#endif // _WIN32
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 const char *string_s4c_gui_version(void)
 {
@@ -29,622 +54,6095 @@ int int_s4c_gui_version(void)
 
 s4c_gui_malloc_func* s4c_gui_inner_malloc = &S4C_GUI_MALLOC;
 s4c_gui_calloc_func* s4c_gui_inner_calloc = &S4C_GUI_CALLOC;
+s4c_gui_free_func* s4c_gui_inner_free = &S4C_GUI_FREE;
 
-#ifndef TEXT_FIELD_H_
-#error "This should not happen. TEXT_FIELD_H_ is defined in s4c_gui.h"
-#include "text_field.h"
-#endif // TEXT_FIELD_H_
+static void* s4c_gui_default_alloc(void* ctx, size_t size)
+{
+    (void) ctx;
+    return s4c_gui_inner_malloc(size);
+}
 
-struct TextField_s {
-    WINDOW* win;
-    int height;
-    int width;
-    int start_x;
-    int start_y;
-    char* buffer;
-    int length;
-    int max_length;
-    TextField_Full_Handler* handler;
-    TextField_Linter** linters;
-    size_t num_linters;
-    const void** linter_args;
-    char* prompt;
-    s4c_gui_malloc_func* malloc_func;
-    s4c_gui_calloc_func* calloc_func;
-    s4c_gui_free_func* free_func;
-};
+static void s4c_gui_default_free(void* ctx, void* obj)
+{
+    (void) ctx;
+    s4c_gui_inner_free(obj);
+}
 
-TextField_Linter* default_linters[TEXTFIELD_DEFAULT_LINTERS_TOT+1] = {
-    &lint_TextField_not_empty,
+const S4C_Gui_Allocator s4c_gui_default_allocator = {
+    .ctx = NULL,
+    .alloc = &s4c_gui_default_alloc,
+    .free = &s4c_gui_default_free,
 };
 
-const void* default_linter_args[TEXTFIELD_DEFAULT_LINTERS_TOT+1] = {
-    NULL,
+struct S4C_Gui_Arena_Block {
+    S4C_Gui_Arena_Block* next;
+    size_t size;
+    size_t offset;
+    char* data;
 };
 
-TextField new_TextField_(TextField_Full_Handler* full_buffer_handler, TextField_Linter** linters, size_t num_linters, const void** linter_args, size_t max_size, int height, int width, int start_x, int start_y, const char* prompt, s4c_gui_malloc_func* malloc_func, s4c_gui_calloc_func* calloc_func, s4c_gui_free_func* free_func)
+static size_t s4c_gui_align_up(size_t size, size_t align)
 {
-    assert(height>=0);
-    assert(width>=0);
-    assert(start_x>=0);
-    assert(start_x>=0);
-    TextField res = NULL;
-    if (malloc_func != NULL) {
-        res = malloc_func(sizeof(struct TextField_s));
-        res->malloc_func = malloc_func;
-        if (free_func != NULL) {
-            res->free_func = free_func;
-        }
-        if (calloc_func != NULL) {
-            res->calloc_func = calloc_func;
-        } else {
-            res->calloc_func = s4c_gui_inner_calloc;
-        }
-    } else {
-        res->free_func = free;
-        res->malloc_func = s4c_gui_inner_malloc;
-        res->calloc_func = s4c_gui_inner_calloc;
-        res = s4c_gui_inner_malloc(sizeof(struct TextField_s));
-    }
-    res->buffer = res->calloc_func(max_size+1, sizeof(char));
-    memset(res->buffer, 0, max_size);
-    if (prompt != NULL) {
-        res->prompt = res->calloc_func(strlen(prompt)+1, sizeof(char));
-        memcpy(res->prompt, prompt, strlen(prompt));
+    return (size + (align - 1)) & ~(align - 1);
+}
+
+static S4C_Gui_Arena_Block* new_S4C_Gui_Arena_Block(size_t size)
+{
+    // Header and data come from a single allocation
+    size_t header_size = s4c_gui_align_up(sizeof(S4C_Gui_Arena_Block), S4C_GUI_ARENA_ALIGN);
+    S4C_Gui_Arena_Block* res = s4c_gui_inner_malloc(header_size + size);
+    if (res == NULL) return NULL;
+    res->next = NULL;
+    res->size = size;
+    res->offset = 0;
+    res->data = ((char*) res) + header_size;
+    return res;
+}
+
+/*
+ * Returns a new arena, with a first block of block_size bytes.
+ */
+S4C_Gui_Arena* new_S4C_Gui_Arena(size_t block_size)
+{
+    S4C_Gui_Arena* res = s4c_gui_inner_malloc(sizeof(S4C_Gui_Arena));
+    if (res == NULL) return NULL;
+    res->block_size = s4c_gui_align_up(block_size > 0 ? block_size : S4C_GUI_ARENA_ALIGN, S4C_GUI_ARENA_ALIGN);
+    res->total_allocs = 0;
+    res->head = new_S4C_Gui_Arena_Block(res->block_size);
+    if (res->head == NULL) {
+        s4c_gui_inner_free(res);
+        return NULL;
     }
-    res->height = height;
-    res->width = width;
-    res->start_x = start_x;
-    res->start_y = start_y;
-    res->win = newwin(height, width, start_y, start_x);
-    res->length = 0;
-    res->max_length = max_size;
-    res->handler = full_buffer_handler;
-    res->num_linters = num_linters;
-    if (linters != NULL && num_linters > 0) {
-        // Alloc memory for the linter callbacks
-        if (calloc_func != NULL) {
-            res->linters = calloc_func(num_linters, sizeof(TextField_Linter*));
-            res->calloc_func = calloc_func;
-            if (free_func != NULL) {
-                res->free_func = free_func;
-            }
-        } else {
-            res->calloc_func = s4c_gui_inner_calloc;
-            res->linters = s4c_gui_inner_calloc(num_linters, sizeof(TextField_Linter*));
-        }
-        res->linter_args = res->calloc_func(num_linters, sizeof(void*));
-        for (size_t i=0; i < num_linters; i++) {
-            if (linters[i] != NULL) {
-                res->linters[i] = linters[i];
-                res->linter_args[i] = linter_args[i];
-            }
-        }
+    return res;
+}
+
+/*
+ * Returns size bytes from the arena, aligned to S4C_GUI_ARENA_ALIGN.
+ * Takes a void* so it can be used as a s4c_gui_ctx_alloc_func.
+ */
+void* alloc_S4C_Gui_Arena(void* arena, size_t size)
+{
+    S4C_Gui_Arena* a = (S4C_Gui_Arena*) arena;
+    if (a == NULL) return NULL;
+    size = s4c_gui_align_up(size, S4C_GUI_ARENA_ALIGN);
+    S4C_Gui_Arena_Block* block = a->head;
+    if (block->offset + size > block->size) {
+        S4C_Gui_Arena_Block* new_block = new_S4C_Gui_Arena_Block(size > a->block_size ? size : a->block_size);
+        if (new_block == NULL) return NULL;
+        new_block->next = block;
+        a->head = new_block;
+        block = new_block;
     }
+    void* res = block->data + block->offset;
+    block->offset += size;
+    a->total_allocs++;
     return res;
 }
 
-TextField new_TextField_centered_(TextField_Full_Handler* full_buffer_handler, TextField_Linter** linters, size_t num_linters, const void** linter_args, size_t max_size, int height, int width, int bound_x, int bound_y, const char* prompt, s4c_gui_malloc_func* malloc_func, s4c_gui_calloc_func* calloc_func, s4c_gui_free_func* free_func)
+/*
+ * Gives back everything allocated from the arena, keeping only its most recent block.
+ */
+void reset_S4C_Gui_Arena(S4C_Gui_Arena* arena)
 {
-    int start_y = (bound_y - height) / 2;
-    int start_x = (bound_x - width) / 2;
-    return new_TextField_(full_buffer_handler, linters, num_linters, linter_args, max_size, height, width, start_x, start_y, prompt, malloc_func, calloc_func, free_func);
+    if (arena == NULL) return;
+    S4C_Gui_Arena_Block* block = arena->head->next;
+    while (block != NULL) {
+        S4C_Gui_Arena_Block* next = block->next;
+        s4c_gui_inner_free(block);
+        block = next;
+    }
+    arena->head->next = NULL;
+    arena->head->offset = 0;
+    arena->total_allocs = 0;
 }
 
-TextField new_TextField(size_t max_size, int height, int width, int start_x, int start_y)
+void free_S4C_Gui_Arena(S4C_Gui_Arena* arena)
 {
-    return new_TextField_(&warn_TextField, default_linters, TEXTFIELD_DEFAULT_LINTERS_TOT, default_linter_args, max_size, height, width, start_x, start_y, NULL, s4c_gui_inner_malloc, s4c_gui_inner_calloc, NULL);
+    if (arena == NULL) return;
+    reset_S4C_Gui_Arena(arena);
+    s4c_gui_inner_free(arena->head);
+    s4c_gui_inner_free(arena);
 }
 
-TextField new_TextField_centered(size_t max_size, int height, int width, int bound_x, int bound_y)
+/*
+ * Returns an allocator drawing from the arena. Its free function is NULL: memory goes back with reset_S4C_Gui_Arena().
+ */
+S4C_Gui_Allocator get_S4C_Gui_Arena_allocator(S4C_Gui_Arena* arena)
 {
-    return new_TextField_centered_(&warn_TextField, default_linters, TEXTFIELD_DEFAULT_LINTERS_TOT, default_linter_args, max_size, height, width, bound_x, bound_y, NULL, s4c_gui_inner_malloc, s4c_gui_inner_calloc, NULL);
+    return (S4C_Gui_Allocator) {
+        .ctx = arena,
+        .alloc = &alloc_S4C_Gui_Arena,
+        .free = NULL,
+    };
 }
 
-TextField new_TextField_linted(TextField_Linter** linters, size_t num_linters, const void** linter_args, size_t max_size, int height, int width, int start_x, int start_y)
+static bool s4c_gui_stats_enabled = false;
+static S4C_Gui_Output_Stats s4c_gui_stats = {0};
+
+/*
+ * Defined with S4C_Gui_Term: they account the output of the current terminal, when it can be measured.
+ */
+static bool begin_S4C_Gui_Term_output(S4C_Gui_Widget widget);
+static void end_S4C_Gui_Term_output(S4C_Gui_Widget widget);
+static void lock_S4C_Gui_Term_output(bool lock);
+
+void enable_s4c_gui_output_stats(bool enabled)
 {
-    return new_TextField_(&warn_TextField, linters, num_linters, linter_args, max_size, height, width, start_x, start_y, NULL, s4c_gui_inner_malloc, s4c_gui_inner_calloc, NULL);
+    lock_S4C_Gui_Term_output(true);
+    s4c_gui_stats_enabled = enabled;
+    lock_S4C_Gui_Term_output(false);
 }
 
-TextField new_TextField_alloc(size_t max_size, int height, int width, int start_x, int start_y, s4c_gui_malloc_func* malloc_func, s4c_gui_calloc_func* calloc_func, s4c_gui_free_func* free_func)
+S4C_Gui_Output_Stats get_s4c_gui_output_stats(void)
 {
-    return new_TextField_(&warn_TextField, default_linters, TEXTFIELD_DEFAULT_LINTERS_TOT, default_linter_args, max_size, height, width, start_x, start_y, NULL, malloc_func, calloc_func, free_func);
+    lock_S4C_Gui_Term_output(true);
+    S4C_Gui_Output_Stats res = s4c_gui_stats;
+    lock_S4C_Gui_Term_output(false);
+    return res;
 }
 
-void free_TextField(TextField txt_field)
+void reset_s4c_gui_output_stats(void)
 {
-    assert(txt_field!=NULL);
-    // Clean up
-    delwin(txt_field->win);
-    if (txt_field->malloc_func == malloc && txt_field->calloc_func == calloc) {
-        if (txt_field->linters != NULL) {
-            free(txt_field->linters);
-            free(txt_field->linter_args);
-        }
-        free(txt_field->buffer);
-        if (txt_field->prompt != NULL) {
-            free(txt_field->prompt);
-        }
-        free(txt_field);
-    } else {
-        if (txt_field->free_func != NULL) {
-            // TODO: Pseudo-free?
-            txt_field->free_func(txt_field);
-        }
-        // Do nothing
+    lock_S4C_Gui_Term_output(true);
+    bool measured = s4c_gui_stats.bytes_measured;
+    memset(&s4c_gui_stats, 0, sizeof(s4c_gui_stats));
+    s4c_gui_stats.bytes_measured = measured;
+    lock_S4C_Gui_Term_output(false);
+}
+
+/*
+ * Adds len bytes of terminal output to the widget's stats. Callers hold the output lock.
+ */
+static void count_s4c_gui_output(S4C_Gui_Widget widget, const char* buf, size_t len)
+{
+    size_t escapes = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == '\033') escapes++;
     }
+    s4c_gui_stats.widgets[widget].bytes += len;
+    s4c_gui_stats.widgets[widget].escapes += escapes;
+    s4c_gui_stats.bytes += len;
+    s4c_gui_stats.escapes += escapes;
 }
 
-const char* get_TextField_value(TextField txt_field)
+static void count_s4c_gui_op(S4C_Gui_Widget widget, S4C_Gui_Op op)
 {
-    assert(txt_field!=NULL);
-    return txt_field->buffer;
+    if (s4c_gui_stats_enabled) s4c_gui_stats.widgets[widget].ops[op]++;
 }
 
-bool lint_TextField(TextField txt_field)
+static size_t s4c_gui_staged_lines[S4C_GUI_WIDGET_MAX+1] = {0}; // Touched lines staged per widget since the last flush
+
+/*
+ * Stages the window with wnoutrefresh(), noting how many of its lines the widget touched.
+ */
+static void s4c_gui_stage(WINDOW* win, S4C_Gui_Widget widget)
 {
-    assert(txt_field!=NULL);
-    bool res = true;
-    TextField_Linter* linter_func = NULL;
-    for (size_t i=0; res == true && i < txt_field->num_linters; i++) {
-        linter_func = txt_field->linters[i];
-        if (linter_func != NULL) {
-            // NULL func being found don't affect the result
-            res = linter_func(txt_field, txt_field->linter_args[i]);
+    if (s4c_gui_stats_enabled) {
+        int rows = getmaxy(win);
+        for (int y = 0; y < rows; y++) {
+            if (is_linetouched(win, y)) s4c_gui_staged_lines[widget]++;
         }
     }
-    return res;
+    wnoutrefresh(win);
 }
 
-int get_TextField_len(TextField txt_field)
+/*
+ * Moves the output accounted to widget since before to the widgets that staged lines for this flush,
+ * sharing it by how many lines each one touched. Callers hold the output lock.
+ */
+static void share_s4c_gui_output(S4C_Gui_Widget widget, S4C_Gui_Widget_Stats before)
 {
-    assert(txt_field!=NULL);
-    return txt_field->length;
+    size_t lines = 0;
+    for (int i = 0; i <= S4C_GUI_WIDGET_MAX; i++) {
+        lines += s4c_gui_staged_lines[i];
+    }
+    if (lines == 0) return;
+    S4C_Gui_Widget_Stats* stats = &(s4c_gui_stats.widgets[widget]);
+    size_t bytes = stats->bytes - before.bytes;
+    size_t escapes = stats->escapes - before.escapes;
+    stats->bytes = before.bytes;
+    stats->escapes = before.escapes;
+    size_t bytes_left = bytes;
+    size_t escapes_left = escapes;
+    for (int i = 0; i <= S4C_GUI_WIDGET_MAX; i++) {
+        size_t share_bytes = bytes * s4c_gui_staged_lines[i] / lines;
+        size_t share_escapes = escapes * s4c_gui_staged_lines[i] / lines;
+        s4c_gui_stats.widgets[i].bytes += share_bytes;
+        s4c_gui_stats.widgets[i].escapes += share_escapes;
+        bytes_left -= share_bytes;
+        escapes_left -= share_escapes;
+    }
+    // Rounding leftovers stay with the flushing widget
+    stats->bytes += bytes_left;
+    stats->escapes += escapes_left;
 }
 
-WINDOW* get_TextField_win(TextField txt_field)
+/*
+ * Flushes with do_flush(win) and accounts the bytes sent to the terminal to widget,
+ * or to the widgets staged with s4c_gui_stage() since the last flush.
+ * Output left pending by the caller is accounted to S4C_GUI_WIDGET_OTHER first.
+ */
+static void flush_s4c_gui_output(S4C_Gui_Widget widget, int (*do_flush)(WINDOW*), WINDOW* win)
 {
-    assert(txt_field!=NULL);
-    return txt_field->win;
+    if (!s4c_gui_stats_enabled) {
+        do_flush(win);
+        return;
+    }
+    end_S4C_Gui_Term_output(S4C_GUI_WIDGET_OTHER);
+    lock_S4C_Gui_Term_output(true);
+    S4C_Gui_Widget_Stats before = s4c_gui_stats.widgets[widget];
+    lock_S4C_Gui_Term_output(false);
+    bool measured = begin_S4C_Gui_Term_output(widget);
+    do_flush(win);
+    end_S4C_Gui_Term_output(widget);
+    lock_S4C_Gui_Term_output(true);
+    share_s4c_gui_output(widget, before);
+    for (int i = 0; i <= S4C_GUI_WIDGET_MAX; i++) {
+        if (s4c_gui_staged_lines[i] > 0 || i == widget) s4c_gui_stats.widgets[i].refreshes++;
+        s4c_gui_staged_lines[i] = 0;
+    }
+    s4c_gui_stats.bytes_measured = measured;
+    s4c_gui_stats.refreshes++;
+    lock_S4C_Gui_Term_output(false);
 }
 
-void draw_TextField(TextField txt)
+typedef struct S4C_Gui_Timer {
+    long long deadline; // Milliseconds, from s4c_gui_now()
+    S4C_Gui_Timer_Handler* handler; // NULL when the slot is free
+    void* arg;
+} S4C_Gui_Timer;
+
+static S4C_Gui_Timer s4c_gui_timers[S4C_GUI_TIMERS_MAX] = {0};
+
+static unsigned s4c_gui_damage = 0; // Bumped when something drawn over the widgets goes away, so they repaint
+
+static long long s4c_gui_now_usecs(void)
 {
-    assert(txt!=NULL);
-    // Draw a box around the window
-    box(txt->win, 0, 0);
-    if (txt->prompt != NULL) {
-        if (txt->buffer[0] == '\0' && txt->width > strlen(txt->prompt)) {
-            mvwprintw(txt->win, 1,1, "%s", txt->prompt);
+    struct timespec now;
+#ifdef _WIN32
+    timespec_get(&now, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif // _WIN32
+    return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static long long s4c_gui_now(void)
+{
+    return s4c_gui_now_usecs() / 1000;
+}
+
+/*
+ * Schedules handler to be called with arg in msecs milliseconds, from a step function or fire_s4c_gui_timers().
+ * Returns the timer id, or 0 when S4C_GUI_TIMERS_MAX timers are already pending.
+ */
+int add_s4c_gui_timer(int msecs, S4C_Gui_Timer_Handler* handler, void* arg)
+{
+    assert(handler!=NULL);
+    for (int i = 0; i < S4C_GUI_TIMERS_MAX; i++) {
+        if (s4c_gui_timers[i].handler == NULL) {
+            s4c_gui_timers[i] = (S4C_Gui_Timer) {
+                .deadline = s4c_gui_now() + (msecs > 0 ? msecs : 0),
+                .handler = handler,
+                .arg = arg,
+            };
+            return i + 1;
         }
     }
-    wrefresh(txt->win);
+    return 0;
 }
 
-void clear_TextField(TextField txt)
+void cancel_s4c_gui_timer(int timer)
 {
-    assert(txt!=NULL);
-    // Zero buffer and length
-    memset(txt->buffer, 0, txt->max_length+1);
-    txt->length = 0;
+    if (timer < 1 || timer > S4C_GUI_TIMERS_MAX) return;
+    s4c_gui_timers[timer - 1].handler = NULL;
 }
 
-void warn_TextField(TextField txt)
+/*
+ * Returns how many milliseconds until the next timer expires, or -1 when none is pending.
+ * Use it as the timeout for the caller's own poll() when driving widgets with step functions.
+ */
+int get_s4c_gui_timers_timeout(void)
 {
-    assert(txt!=NULL);
-    WINDOW* win = get_TextField_win(txt);
-    // Buffer is full and user passed one more char. Discard it.
-    wclear(win);
-    box(win,0,0);
-    mvwprintw(win, 1, 1, "%s", "Input is full.");
-    mvwprintw(win, 2, 1, "%s", "Press Enter or Backspace.");
-    wrefresh(win);
-    napms(500);
-    wclear(win);
-    box(win,0,0);
-    mvwprintw(win, 1, 1, "%s", get_TextField_value(txt));
-    wrefresh(win);
+    long long res = -1;
+    long long now = s4c_gui_now();
+    for (int i = 0; i < S4C_GUI_TIMERS_MAX; i++) {
+        if (s4c_gui_timers[i].handler == NULL) continue;
+        long long left = s4c_gui_timers[i].deadline - now;
+        if (left < 0) left = 0;
+        if (res < 0 || left < res) res = left;
+    }
+    return (res > INT_MAX ? INT_MAX : (int) res);
+}
 
+/*
+ * Calls the handlers of expired timers, then frees their slots. Returns how many were called.
+ */
+int fire_s4c_gui_timers(void)
+{
+    int res = 0;
+    long long now = s4c_gui_now();
+    for (int i = 0; i < S4C_GUI_TIMERS_MAX; i++) {
+        S4C_Gui_Timer timer = s4c_gui_timers[i];
+        if (timer.handler == NULL || timer.deadline > now) continue;
+        // Free the slot first: the handler may schedule another timer
+        s4c_gui_timers[i].handler = NULL;
+        timer.handler(timer.arg);
+        res++;
+    }
+    return res;
 }
 
-bool lint_TextField_not_empty(TextField txt, const void* unused)
+static int s4c_gui_doupdate(WINDOW* win)
 {
-    (void) unused;
-    if (txt==NULL) return false;
-    return txt->length>0;
+    (void) win;
+    return doupdate();
 }
 
-bool lint_TextField_equals_cstr(TextField txt, const void* cstr)
+static int s4c_gui_frame_msecs = (S4C_GUI_MAX_FPS > 0 ? 1000 / S4C_GUI_MAX_FPS : 0); // 0 sends every flush right away
+static long long s4c_gui_last_frame = 0; // When the last frame was sent, from s4c_gui_now()
+static int s4c_gui_frame_timer = 0; // Sends the deferred frame, 0 when none is pending
+static S4C_Gui_Widget s4c_gui_frame_widget = S4C_GUI_WIDGET_OTHER; // Widget the deferred frame is accounted to
+static int s4c_gui_stepping = 0; // Step loops running: only their frames are deferred
+
+/*
+ * Sets the max frames sent to the terminal per second, 0 for no cap. A pending frame is sent right away.
+ */
+void set_s4c_gui_max_fps(int fps)
 {
-    // Please, pass a null-terminated string.
-    const char* str = (const char*) cstr;
+    s4c_gui_frame_msecs = (fps > 0 ? (fps < 1000 ? 1000 / fps : 1) : 0);
+    flush_s4c_gui_frame();
+}
 
-    return (strcmp(get_TextField_value(txt), str) == 0);
+static void frame_s4c_gui_replay(void);
+
+static void send_s4c_gui_frame(S4C_Gui_Widget widget)
+{
+    cancel_s4c_gui_timer(s4c_gui_frame_timer);
+    s4c_gui_frame_timer = 0;
+    flush_s4c_gui_output(widget, &s4c_gui_doupdate, NULL);
+    s4c_gui_last_frame = s4c_gui_now();
+    frame_s4c_gui_replay();
 }
 
+static void expire_s4c_gui_frame(void* arg)
+{
+    (void) arg;
+    // The slot was already freed by fire_s4c_gui_timers()
+    s4c_gui_frame_timer = 0;
+    send_s4c_gui_frame(s4c_gui_frame_widget);
+}
 
-bool lint_TextField_whitelist(TextField txt, const void* whitelist)
+/*
+ * Sends the frame deferred by the frame rate cap, if any. Widgets call this before giving the screen back.
+ */
+void flush_s4c_gui_frame(void)
 {
-    // Please, pass a null-terminated string.
-    const char* whitelist_cstr = (const char*) whitelist;
-    size_t whitelist_size = strlen(whitelist);
-    if (txt==NULL || whitelist == NULL) return false;
-    bool res = true;
-    for (size_t i=0; res == true && i < txt->length; i++) {
-        for (size_t j=0; res == true && j < whitelist_size; j++) {
-            res = (txt->buffer[i] != whitelist_cstr[j]);
-        }
-    }
-    return res;
+    if (s4c_gui_frame_timer != 0) send_s4c_gui_frame(s4c_gui_frame_widget);
 }
 
-bool lint_TextField_char_range(TextField txt, int min, int max)
+/*
+ * Sends what was staged with s4c_gui_stage() to the terminal, at most once per frame while a step loop runs.
+ * A flush from one coming before the frame is due only schedules it: the staged windows are sent together then,
+ * so input keeps being handled while the terminal catches up. Any other flush, like a one-shot draw_TextField()
+ * from the caller's code, sends the frame right away along with what was deferred.
+ */
+static void s4c_gui_update(S4C_Gui_Widget widget)
 {
-    if (txt==NULL) return false;
-    if (min < 0 || max > CHAR_MAX) return false;
-    bool res = true;
-    char ch = -1;
-    for (size_t i=0; res == true && i < txt->length; i++) {
-        ch = txt->buffer[i];
-        if (ch == '\0') {
-            if (i != txt->length) {
-                //TODO: mismatch on len?
+    long long now = s4c_gui_now();
+    long long wait = s4c_gui_last_frame + s4c_gui_frame_msecs - now;
+    if (s4c_gui_frame_msecs > 0 && s4c_gui_stepping > 0 && wait > 0) {
+        if (s4c_gui_frame_timer == 0) {
+            s4c_gui_frame_widget = widget;
+            s4c_gui_frame_timer = add_s4c_gui_timer((int) wait, &expire_s4c_gui_frame, NULL);
+        }
+        // With no timer slot left, don't risk losing the frame
+        if (s4c_gui_frame_timer != 0) {
+            if (s4c_gui_stats_enabled) {
+                lock_S4C_Gui_Term_output(true);
+                s4c_gui_stats.deferred++;
+                lock_S4C_Gui_Term_output(false);
             }
-            break;
+            return;
         }
-        res = (ch >= min && ch > max);
     }
-    return res;
+    send_s4c_gui_frame(widget);
 }
 
-bool lint_TextField_digits_only(TextField txt)
+static WINDOW* s4c_gui_input_pad = NULL; // Reads keys while a frame is held back, NULL until needed
+static WINDOW* s4c_gui_input_pad_screen = NULL; // curscr of the screen the pad belongs to
+
+/*
+ * Returns the window to read the keys for win from. wgetch() refreshes any window but a pad, which would send
+ * the frame held back by the frame rate cap, or cost a doupdate() per key when draining typeahead without waiting:
+ * then keys are read from a pad set up like win, and the caller refreshes once it handled them.
+ */
+static WINDOW* s4c_gui_input_win(WINDOW* win)
 {
-    if(txt==NULL) return false;
-    return lint_TextField_char_range(txt, '0', '9');
+    if (s4c_gui_frame_timer == 0 && wgetdelay(win) != 0) return win;
+    if (s4c_gui_input_pad == NULL || s4c_gui_input_pad_screen != curscr) {
+        // The pad of another screen is freed with it
+        s4c_gui_input_pad = newpad(1, 1);
+        s4c_gui_input_pad_screen = curscr;
+        if (s4c_gui_input_pad == NULL) return win;
+    }
+    // keypad() sends keypad_xmit each time it's called
+    if (is_keypad(s4c_gui_input_pad) != is_keypad(win)) keypad(s4c_gui_input_pad, is_keypad(win));
+    wtimeout(s4c_gui_input_pad, wgetdelay(win));
+    return s4c_gui_input_pad;
 }
 
-bool lint_TextField_printable_only(TextField txt)
+static void s4c_gui_wrefresh(WINDOW* win, S4C_Gui_Widget widget)
 {
-    if(txt==NULL) return false;
-    return lint_TextField_char_range(txt, ' ', '~');
+    s4c_gui_stage(win, widget);
+    s4c_gui_update(widget);
 }
 
-static void get_userText(TextField txt_field)
+/*
+ * Recording file layout: "S4CR", u32 version little endian, then one record per input event:
+ *   varint milliseconds since the previous event, varint key
+ *   KEY_MOUSE adds varint x, y and bstate from getmouse(), all 0 when the event wasn't read
+ *   KEY_RESIZE adds varint LINES and COLS after the resize
+ * Varints take 7 bits per byte, low bits first, with the high bit set on all bytes but the last.
+ */
+#define S4C_GUI_RECORDING_MAGIC "S4CR"
+#define S4C_GUI_RECORDING_HEADER_SIZE 8
+
+typedef struct S4C_Gui_Input_Event {
+    long long msecs; // Since the recording started
+    int key;
+    int y; // KEY_MOUSE row, KEY_RESIZE LINES
+    int x; // KEY_MOUSE column, KEY_RESIZE COLS
+    unsigned long long bstate; // KEY_MOUSE buttons
+} S4C_Gui_Input_Event;
+
+static FILE* s4c_gui_recording = NULL; // NULL when not recording
+static long long s4c_gui_recording_start = 0; // From s4c_gui_now()
+static long long s4c_gui_recording_last = 0; // msecs of the last event written
+static S4C_Gui_Input_Event s4c_gui_recorded = {0}; // Last event read, written on the next read: getmouse() may fill it in
+static bool s4c_gui_recorded_held = false;
+static long long s4c_gui_unread_msecs = -1; // When the key put back was first read, -1 when none
+
+typedef struct S4C_Gui_Replay {
+    S4C_Gui_Input_Event* events;
+    long long* latencies; // When each event was fed, until its latency is known
+    size_t num_events;
+    size_t next; // Next event to feed
+    size_t settled; // Events with a known latency
+    size_t frames; // Frames sent since the replay started
+    int unread; // Keys put back by the widgets: they're read again before the next event is fed
+    long long start; // From s4c_gui_now()
+    bool realtime; // Feed events at their recorded times, instead of as soon as input is read
+} S4C_Gui_Replay;
+
+static S4C_Gui_Replay* s4c_gui_replay = NULL; // NULL when not replaying
+
+static void put_s4c_gui_varint(FILE* file, unsigned long long val)
+{
+    while (val >= 0x80) {
+        fputc((int) ((val & 0x7f) | 0x80), file);
+        val >>= 7;
+    }
+    fputc((int) val, file);
+}
+
+static bool get_s4c_gui_varint(const unsigned char** cursor, const unsigned char* end, unsigned long long* val)
+{
+    *val = 0;
+    for (int shift = 0; *cursor < end && shift < 64; shift += 7) {
+        unsigned char byte = *((*cursor)++);
+        *val |= (unsigned long long) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+/*
+ * Writes the event held since the last read, if any.
+ */
+static void write_s4c_gui_recorded(void)
+{
+    if (!s4c_gui_recorded_held) return;
+    S4C_Gui_Input_Event* event = &s4c_gui_recorded;
+    long long delta = event->msecs - s4c_gui_recording_last;
+    put_s4c_gui_varint(s4c_gui_recording, (delta > 0 ? delta : 0));
+    if (delta > 0) s4c_gui_recording_last = event->msecs;
+    put_s4c_gui_varint(s4c_gui_recording, event->key);
+    if (event->key == KEY_MOUSE) {
+        put_s4c_gui_varint(s4c_gui_recording, (event->x > 0 ? event->x : 0));
+        put_s4c_gui_varint(s4c_gui_recording, (event->y > 0 ? event->y : 0));
+        put_s4c_gui_varint(s4c_gui_recording, event->bstate);
+    } else if (event->key == KEY_RESIZE) {
+        put_s4c_gui_varint(s4c_gui_recording, event->y);
+        put_s4c_gui_varint(s4c_gui_recording, event->x);
+    }
+    s4c_gui_recorded_held = false;
+}
+
+static void record_s4c_gui_key(int key)
+{
+    write_s4c_gui_recorded();
+    long long msecs = s4c_gui_now() - s4c_gui_recording_start;
+    if (s4c_gui_unread_msecs >= 0) {
+        // Read again after being put back: it's still the same event
+        msecs = s4c_gui_unread_msecs;
+        s4c_gui_unread_msecs = -1;
+    }
+    s4c_gui_recorded = (S4C_Gui_Input_Event) {
+        .msecs = msecs,
+        .key = key,
+    };
+    if (key == KEY_RESIZE) {
+        s4c_gui_recorded.y = LINES;
+        s4c_gui_recorded.x = COLS;
+    }
+    s4c_gui_recorded_held = true;
+}
+
+/*
+ * Starts recording the input events read by the widgets, with their timing, to path, replacing it.
+ * Returns false when the file can't be opened or a recording is already running.
+ */
+bool start_s4c_gui_recording(const char* path)
+{
+    assert(path!=NULL);
+    if (s4c_gui_recording != NULL) return false;
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return false;
+    unsigned char header[S4C_GUI_RECORDING_HEADER_SIZE];
+    memcpy(header, S4C_GUI_RECORDING_MAGIC, 4);
+    for (int i = 0; i < 4; i++) {
+        header[4 + i] = (S4C_GUI_RECORDING_VERSION >> (8 * i)) & 0xff;
+    }
+    if (fwrite(header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        return false;
+    }
+    s4c_gui_recording = file;
+    s4c_gui_recording_start = s4c_gui_now();
+    s4c_gui_recording_last = 0;
+    s4c_gui_recorded_held = false;
+    s4c_gui_unread_msecs = -1;
+    return true;
+}
+
+/*
+ * Ends the recording. Returns false when some of it couldn't be written.
+ */
+bool stop_s4c_gui_recording(void)
+{
+    if (s4c_gui_recording == NULL) return false;
+    write_s4c_gui_recorded();
+    bool res = (ferror(s4c_gui_recording) == 0);
+    if (fclose(s4c_gui_recording) != 0) res = false;
+    s4c_gui_recording = NULL;
+    return res;
+}
+
+/*
+ * Parses the events of a recording into events, when not NULL. Returns how many there are, or -1 when it's malformed.
+ */
+static long parse_s4c_gui_recording(const unsigned char* data, size_t size, S4C_Gui_Input_Event* events)
+{
+    if (size < S4C_GUI_RECORDING_HEADER_SIZE || memcmp(data, S4C_GUI_RECORDING_MAGIC, 4) != 0) return -1;
+    uint32_t version = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t) data[7] << 24);
+    if (version != S4C_GUI_RECORDING_VERSION) return -1;
+    const unsigned char* cursor = data + S4C_GUI_RECORDING_HEADER_SIZE;
+    const unsigned char* end = data + size;
+    long res = 0;
+    long long msecs = 0;
+    while (cursor < end) {
+        unsigned long long delta, key, x = 0, y = 0, bstate = 0;
+        if (!get_s4c_gui_varint(&cursor, end, &delta) || !get_s4c_gui_varint(&cursor, end, &key)) return -1;
+        if (key > INT_MAX || delta > INT_MAX) return -1;
+        if (key == KEY_MOUSE) {
+            if (!get_s4c_gui_varint(&cursor, end, &x) || !get_s4c_gui_varint(&cursor, end, &y)) return -1;
+            if (!get_s4c_gui_varint(&cursor, end, &bstate)) return -1;
+        } else if (key == KEY_RESIZE) {
+            if (!get_s4c_gui_varint(&cursor, end, &y) || !get_s4c_gui_varint(&cursor, end, &x)) return -1;
+        }
+        if (x > INT_MAX || y > INT_MAX) return -1;
+        msecs += delta;
+        if (events != NULL) {
+            events[res] = (S4C_Gui_Input_Event) {
+                .msecs = msecs,
+                .key = (int) key,
+                .y = (int) y,
+                .x = (int) x,
+                .bstate = bstate,
+            };
+        }
+        res++;
+    }
+    return res;
+}
+
+/*
+ * Starts feeding the events recorded to path by start_s4c_gui_recording() to the widgets, in place of the terminal's
+ * input, until the last one is read. With realtime, events are fed at their recorded times, so timers fire as they
+ * did; otherwise each is fed as soon as the widgets read input.
+ * Returns false when the file can't be read, is malformed or a replay is already running.
+ */
+bool start_s4c_gui_replay(const char* path, bool realtime)
+{
+    assert(path!=NULL);
+    if (s4c_gui_replay != NULL) return false;
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+    long size = (fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1);
+    unsigned char* data = (size >= S4C_GUI_RECORDING_HEADER_SIZE ? s4c_gui_inner_malloc(size) : NULL);
+    bool read = false;
+    if (data != NULL) {
+        rewind(file);
+        read = (fread(data, size, 1, file) == 1);
+    }
+    fclose(file);
+    long num_events = (read ? parse_s4c_gui_recording(data, size, NULL) : -1);
+    S4C_Gui_Replay* replay = NULL;
+    if (num_events >= 0) {
+        // One block: the replay, then its events, then their latencies
+        size_t replay_size = sizeof(S4C_Gui_Replay) + num_events * (sizeof(S4C_Gui_Input_Event) + sizeof(long long));
+        replay = s4c_gui_inner_calloc(1, replay_size);
+    }
+    if (replay != NULL) {
+        replay->events = (S4C_Gui_Input_Event*) (replay + 1);
+        replay->latencies = (long long*) (replay->events + num_events);
+        replay->num_events = num_events;
+        parse_s4c_gui_recording(data, size, replay->events);
+        replay->start = s4c_gui_now();
+        replay->realtime = realtime;
+        s4c_gui_replay = replay;
+    }
+    s4c_gui_inner_free(data);
+    return (replay != NULL);
+}
+
+void stop_s4c_gui_replay(void)
+{
+    s4c_gui_inner_free(s4c_gui_replay);
+    s4c_gui_replay = NULL;
+}
+
+static int compare_s4c_gui_latencies(const void* a, const void* b)
+{
+    long long lhs = *((const long long*) a);
+    long long rhs = *((const long long*) b);
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/*
+ * Returns the replay progress and the input to screen latency of the events fed so far:
+ * from when an event is fed to when the frame showing it is sent, or to when the widget reads input again if it
+ * changed nothing on screen.
+ */
+S4C_Gui_Replay_Stats get_s4c_gui_replay_stats(void)
+{
+    S4C_Gui_Replay_Stats res = {0};
+    S4C_Gui_Replay* replay = s4c_gui_replay;
+    if (replay == NULL) return res;
+    res.events = replay->next;
+    res.events_left = replay->num_events - replay->next;
+    res.frames = replay->frames;
+    if (replay->settled == 0) return res;
+    long long* sorted = s4c_gui_inner_malloc(replay->settled * sizeof(long long));
+    if (sorted == NULL) return res;
+    memcpy(sorted, replay->latencies, replay->settled * sizeof(long long));
+    qsort(sorted, replay->settled, sizeof(long long), &compare_s4c_gui_latencies);
+    res.p50_usecs = sorted[(replay->settled - 1) * 50 / 100];
+    res.p99_usecs = sorted[(replay->settled - 1) * 99 / 100];
+    res.max_usecs = sorted[replay->settled - 1];
+    s4c_gui_inner_free(sorted);
+    return res;
+}
+
+/*
+ * The events fed since the last settled one are done with: their latency ends now.
+ */
+static void settle_s4c_gui_replay(long long now)
+{
+    S4C_Gui_Replay* replay = s4c_gui_replay;
+    for (; replay->settled < replay->next; replay->settled++) {
+        replay->latencies[replay->settled] = now - replay->latencies[replay->settled];
+    }
+}
+
+static void frame_s4c_gui_replay(void)
+{
+    if (s4c_gui_replay == NULL) return;
+    s4c_gui_replay->frames++;
+    settle_s4c_gui_replay(s4c_gui_now_usecs());
+}
+
+/*
+ * Returns how many milliseconds until the next recorded event is due, or -1 when not replaying or all were fed.
+ */
+static int get_s4c_gui_replay_timeout(void)
+{
+    S4C_Gui_Replay* replay = s4c_gui_replay;
+    if (replay == NULL || replay->next >= replay->num_events) return -1;
+    if (!replay->realtime || replay->unread > 0) return 0;
+    long long left = replay->start + replay->events[replay->next].msecs - s4c_gui_now();
+    if (left <= 0) return 0;
+    return (left > INT_MAX ? INT_MAX : (int) left);
+}
+
+/*
+ * Queues the next recorded event when it's due and the keys put back were read again, so events keep their order.
+ */
+static void feed_s4c_gui_replay(void)
+{
+    S4C_Gui_Replay* replay = s4c_gui_replay;
+    if (replay == NULL || replay->unread > 0 || get_s4c_gui_replay_timeout() != 0) return;
+    const S4C_Gui_Input_Event* event = &(replay->events[replay->next]);
+    switch (event->key) {
+    case KEY_MOUSE: {
+        MEVENT mouse_event = {
+            .x = event->x,
+            .y = event->y,
+            .bstate = (mmask_t) event->bstate,
+        };
+        ungetmouse(&mouse_event);
+    }
+    break;
+    case KEY_RESIZE: {
+        resize_term(event->y, event->x);
+        ungetch(KEY_RESIZE);
+    }
+    break;
+    default: {
+        ungetch(event->key);
+    }
+    break;
+    }
+    replay->latencies[replay->next++] = s4c_gui_now_usecs();
+}
+
+/*
+ * Reads a key from win like wgetch(), feeding the replay and recording the event.
+ */
+static int s4c_gui_read_key(WINDOW* win)
+{
+    feed_s4c_gui_replay();
+    int res = wgetch(s4c_gui_input_win(win));
+    if (res == ERR) return res;
+    if (s4c_gui_replay != NULL && s4c_gui_replay->unread > 0) s4c_gui_replay->unread--;
+    if (s4c_gui_recording != NULL) record_s4c_gui_key(res);
+    return res;
+}
+
+/*
+ * Puts back the key just read with s4c_gui_read_key(): reading it again gets the same event.
+ */
+static void s4c_gui_unread_key(int key)
+{
+    ungetch(key);
+    if (s4c_gui_replay != NULL) s4c_gui_replay->unread++;
+    if (s4c_gui_recording != NULL && s4c_gui_recorded_held) {
+        s4c_gui_unread_msecs = s4c_gui_recorded.msecs;
+        s4c_gui_recorded_held = false;
+    }
+}
+
+/*
+ * Puts back the mouse event just read with s4c_gui_getmouse(), along with its KEY_MOUSE.
+ */
+static void s4c_gui_unread_mouse(MEVENT* mouse_event)
+{
+    ungetmouse(mouse_event);
+    if (s4c_gui_replay != NULL) s4c_gui_replay->unread++;
+    if (s4c_gui_recording != NULL && s4c_gui_recorded_held) {
+        s4c_gui_unread_msecs = s4c_gui_recorded.msecs;
+        s4c_gui_recorded_held = false;
+    }
+}
+
+/*
+ * Gets the mouse event of the KEY_MOUSE just read like getmouse(), recording it with the key.
+ */
+static int s4c_gui_getmouse(MEVENT* mouse_event)
+{
+    int res = getmouse(mouse_event);
+    if (res == OK && s4c_gui_recording != NULL && s4c_gui_recorded_held && s4c_gui_recorded.key == KEY_MOUSE) {
+        s4c_gui_recorded.y = mouse_event->y;
+        s4c_gui_recorded.x = mouse_event->x;
+        s4c_gui_recorded.bstate = mouse_event->bstate;
+    }
+    return res;
+}
+
+#define S4C_GUI_KEY_TIMER (KEY_MAX + 1) // Returned by s4c_gui_wgetch() when timers fired before any input
+
+/*
+ * Reads a key from win waiting up to *timeout milliseconds, -1 to block, and leaves the time left in *timeout.
+ * Returns S4C_GUI_KEY_TIMER when timers fired first, so the caller can repaint and read again.
+ * Returns ERR when the timeout passed or when input is gone.
+ */
+static int s4c_gui_wgetch(WINDOW* win, int* timeout)
+{
+    // Back for more input: what the replay fed was handled
+    if (s4c_gui_replay != NULL && s4c_gui_frame_timer == 0) settle_s4c_gui_replay(s4c_gui_now_usecs());
+    long long start = s4c_gui_now();
+    int wait = *timeout;
+    int timers_wait = get_s4c_gui_timers_timeout();
+    bool for_timer = (timers_wait >= 0 && (wait < 0 || timers_wait < wait));
+    if (for_timer) wait = timers_wait;
+    int replay_wait = get_s4c_gui_replay_timeout();
+    if (replay_wait >= 0 && (wait < 0 || replay_wait < wait)) {
+        wait = replay_wait;
+        for_timer = true;
+    }
+    int res;
+    if (replay_wait >= 0) {
+        // Recorded events stand in for the terminal's input: sleep until the next one is due
+        wtimeout(win, 0);
+        res = s4c_gui_read_key(win);
+        if (res == ERR && wait > 0) napms(wait);
+    } else {
+        wtimeout(win, wait);
+        res = s4c_gui_read_key(win);
+    }
+    wtimeout(win, -1);
+    long long elapsed = s4c_gui_now() - start;
+    if (*timeout > 0) *timeout = (elapsed < *timeout ? *timeout - elapsed : 0);
+    fire_s4c_gui_timers();
+    // A read failing before its timeout means input is gone: keep ERR for that
+    if (res == ERR && for_timer && elapsed >= wait) res = S4C_GUI_KEY_TIMER;
+    return res;
+}
+
+
+/*
+ * Waits up to *timeout milliseconds, -1 to block, for input on win or for wake_fd to be readable, and leaves the time
+ * left in *timeout. Stops early when timers are due, leaving them to s4c_gui_wgetch().
+ * Returns true when wake_fd is readable and no input is ready, counting the keys curses already buffered.
+ */
+static bool wait_s4c_gui_wake(WINDOW* win, int wake_fd, int* timeout)
+{
+#ifndef _WIN32
+    if (wake_fd < 0) return false;
+    // Keys curses already read from the fd don't show up in poll()
+    wtimeout(win, 0);
+    int c = s4c_gui_read_key(win);
+    wtimeout(win, -1);
+    if (c != ERR) {
+        s4c_gui_unread_key(c);
+        return false;
+    }
+    long long start = s4c_gui_now();
+    int wait = *timeout;
+    int timers_wait = get_s4c_gui_timers_timeout();
+    if (timers_wait >= 0 && (wait < 0 || timers_wait < wait)) wait = timers_wait;
+    int replay_wait = get_s4c_gui_replay_timeout();
+    if (replay_wait >= 0 && (wait < 0 || replay_wait < wait)) wait = replay_wait;
+    struct pollfd fds[2] = {
+        { .fd = get_s4c_gui_input_fd(), .events = POLLIN },
+        { .fd = wake_fd, .events = POLLIN },
+    };
+    int ready = poll(fds, 2, wait);
+    long long elapsed = s4c_gui_now() - start;
+    if (*timeout > 0) *timeout = (elapsed < *timeout ? *timeout - elapsed : 0);
+    return (ready > 0 && (fds[1].revents & POLLIN) && fds[0].revents == 0);
+#else
+    // No self-pipe: posted values show up with the next input event or timer
+    (void) win;
+    (void) wake_fd;
+    (void) timeout;
+    return false;
+#endif // _WIN32
+}
+
+/*
+ * Drops the KEY_RESIZE events queued right after the one just read from win, since only the last size matters.
+ */
+static void drain_s4c_gui_resizes(WINDOW* win)
+{
+    wtimeout(win, 0);
+    int c;
+    while ((c = s4c_gui_read_key(win)) == KEY_RESIZE);
+    wtimeout(win, -1);
+    if (c != ERR) s4c_gui_unread_key(c);
+}
+
+/*
+ * Moves and resizes win to the passed geometry, shifted up and left, then shrunk, so that it fits the screen.
+ * The window contents are kept where they still fit: the caller redraws what depends on the size.
+ * Returns false when the screen has no room for the window, leaving it as is.
+ */
+static bool fit_s4c_gui_win(WINDOW* win, int height, int width, int start_y, int start_x)
+{
+    if (win == NULL) return false;
+    if (height > LINES) height = LINES;
+    if (width > COLS) width = COLS;
+    if (height < 1 || width < 1) return false;
+    if (start_y + height > LINES) start_y = LINES - height;
+    if (start_x + width > COLS) start_x = COLS - width;
+    if (start_y < 0) start_y = 0;
+    if (start_x < 0) start_x = 0;
+    // Resize first: mvwin() refuses windows sticking out of the screen, wresize() doesn't
+    if (getmaxy(win) != height || getmaxx(win) != width) {
+        if (wresize(win, height, width) != OK) return false;
+    }
+    if (getbegy(win) != start_y || getbegx(win) != start_x) {
+        if (mvwin(win, start_y, start_x) != OK) return false;
+    }
+    return true;
+}
+
+static WINDOW* s4c_gui_win_pool[S4C_GUI_WIN_POOL_MAX]; // Released windows, kept for reuse
+static int s4c_gui_win_pool_len = 0;
+static WINDOW* s4c_gui_win_pool_screen = NULL; // curscr of the screen the pooled windows belong to
+
+/*
+ * Returns a blank window with the passed geometry like newwin(), reusing a released one when there's any.
+ */
+static WINDOW* take_s4c_gui_win(int height, int width, int start_y, int start_x)
+{
+    if (s4c_gui_win_pool_screen != curscr) {
+        // Windows of another screen are freed with it
+        s4c_gui_win_pool_len = 0;
+        s4c_gui_win_pool_screen = curscr;
+    }
+    // Geometry newwin() refuses gets refused the same way
+    bool fits = (height > 0 && width > 0 && start_y >= 0 && start_x >= 0
+                 && start_y + height <= LINES && start_x + width <= COLS);
+    if (fits && s4c_gui_win_pool_len > 0) {
+        WINDOW* res = s4c_gui_win_pool[--s4c_gui_win_pool_len];
+        if (fit_s4c_gui_win(res, height, width, start_y, start_x)) {
+            // As newwin() makes it
+            werase(res);
+            wattrset(res, A_NORMAL);
+            keypad(res, FALSE);
+            wtimeout(res, -1);
+            return res;
+        }
+        delwin(res);
+    }
+    return newwin(height, width, start_y, start_x);
+}
+
+/*
+ * Releases win, from take_s4c_gui_win(), keeping it for reuse while the pool has room. Doesn't touch the screen.
+ */
+static void give_s4c_gui_win(WINDOW* win)
+{
+    if (win == NULL) return;
+    if (s4c_gui_win_pool_screen != curscr) {
+        s4c_gui_win_pool_len = 0;
+        s4c_gui_win_pool_screen = curscr;
+    }
+    if (s4c_gui_win_pool_len < S4C_GUI_WIN_POOL_MAX) {
+        s4c_gui_win_pool[s4c_gui_win_pool_len++] = win;
+        return;
+    }
+    delwin(win);
+}
+
+/*
+ * Stages stdscr as a whole after a resize, so nothing drawn for the old screen size is left around the windows.
+ * Other widgets repaint on their next step.
+ */
+static void uncover_s4c_gui_screen(void)
+{
+    touchwin(stdscr);
+    wnoutrefresh(stdscr);
+    s4c_gui_damage++;
+}
+
+static void expire_s4c_gui_notice(void* arg)
+{
+    delwin((WINDOW*) arg);
+    // Uncover what was below: stdscr now, the widgets on their next step
+    touchwin(stdscr);
+    wnoutrefresh(stdscr);
+    s4c_gui_damage++;
+}
+
+/*
+ * Shows msg in a boxed window at y, x for msecs milliseconds, without blocking. msg can span multiple lines.
+ * Returns the id of the timer removing it, or 0 when it could not be shown.
+ */
+int show_s4c_gui_notice(int y, int x, const char* msg, int msecs)
+{
+    assert(msg!=NULL);
+    int lines = 1;
+    int width = 0;
+    int line_width = 0;
+    for (const char* c = msg; *c != '\0'; c++) {
+        if (*c == '\n') {
+            if (c[1] != '\0') lines++;
+            line_width = 0;
+        } else if (++line_width > width) {
+            width = line_width;
+        }
+    }
+    int height = (lines + 2 < LINES ? lines + 2 : LINES);
+    width = (width + 2 < COLS ? width + 2 : COLS);
+    if (y + height > LINES) y = LINES - height;
+    if (x + width > COLS) x = COLS - width;
+    WINDOW* win = newwin(height, width, (y > 0 ? y : 0), (x > 0 ? x : 0));
+    if (win == NULL) return 0;
+    int res = add_s4c_gui_timer(msecs, &expire_s4c_gui_notice, win);
+    if (res == 0) {
+        delwin(win);
+        return 0;
+    }
+    box(win, 0, 0);
+    count_s4c_gui_op(S4C_GUI_WIDGET_OTHER, S4C_GUI_OP_BOX);
+    int row = 1;
+    const char* line = msg;
+    while (row <= height - 2 && *line != '\0') {
+        const char* end = strchr(line, '\n');
+        int len = (end != NULL ? (int) (end - line) : (int) strlen(line));
+        mvwprintw(win, row++, 1, "%.*s", (len < width - 2 ? len : width - 2), line);
+        count_s4c_gui_op(S4C_GUI_WIDGET_OTHER, S4C_GUI_OP_PRINT);
+        if (end == NULL) break;
+        line = end + 1;
+    }
+    s4c_gui_wrefresh(win, S4C_GUI_WIDGET_OTHER);
+    return res;
+}
+
+#ifndef TEXT_FIELD_H_
+#error "This should not happen. TEXT_FIELD_H_ is defined in s4c_gui.h"
+#include "text_field.h"
+#endif // TEXT_FIELD_H_
+
+struct TextField_s {
+    WINDOW* win;
+    int height;
+    int width;
+    int start_x;
+    int start_y;
+    char* buffer; // Gap buffer: text is buffer[0, gap_start) followed by buffer[gap_end, max_length)
+    int length;
+    int max_length;
+    int cursor; // Insertion point, from 0 to length
+    int gap_start; // Only moved to the cursor by edits
+    int gap_end;
+    TextField_Full_Handler* handler;
+    TextField_Linter** linters;
+    size_t num_linters;
+    const void** linter_args;
+    char* prompt;
+    s4c_gui_malloc_func* malloc_func;
+    s4c_gui_calloc_func* calloc_func;
+    s4c_gui_free_func* free_func;
+    S4C_Gui_Allocator allocator; // Used when single_block is true
+    bool single_block; // The struct and everything it owns are a single allocation
+    TextField_IncLint_State* lint_states; // One per linter
+    bool live_lint;
+    bool lint_passing; // Last live lint verdict
+    TextField_Lint_Handler* lint_handler;
+    int warn_timer; // Timer clearing the warn_TextField() message, 0 when none
+    unsigned damage; // Value of s4c_gui_damage when last drawn
+    bool modified; // Set by every change to the value, cleared by whoever watches it
+};
+
+static void reset_TextField_lint(TextField txt);
+
+TextField_Linter* default_linters[TEXTFIELD_DEFAULT_LINTERS_TOT+1] = {
+    &lint_TextField_not_empty,
+};
+
+const void* default_linter_args[TEXTFIELD_DEFAULT_LINTERS_TOT+1] = {
+    NULL,
+};
+
+TextField new_TextField_(TextField_Full_Handler* full_buffer_handler, TextField_Linter** linters, size_t num_linters, const void** linter_args, size_t max_size, int height, int width, int start_x, int start_y, const char* prompt, s4c_gui_malloc_func* malloc_func, s4c_gui_calloc_func* calloc_func, s4c_gui_free_func* free_func)
+{
+    assert(height>=0);
+    assert(width>=0);
+    assert(start_x>=0);
+    assert(start_x>=0);
+    TextField res = NULL;
+    if (malloc_func != NULL) {
+        res = malloc_func(sizeof(struct TextField_s));
+        memset(res, 0, sizeof(struct TextField_s));
+        res->malloc_func = malloc_func;
+        if (free_func != NULL) {
+            res->free_func = free_func;
+        }
+        if (calloc_func != NULL) {
+            res->calloc_func = calloc_func;
+        } else {
+            res->calloc_func = s4c_gui_inner_calloc;
+        }
+    } else {
+        res = s4c_gui_inner_malloc(sizeof(struct TextField_s));
+        memset(res, 0, sizeof(struct TextField_s));
+        res->free_func = s4c_gui_inner_free;
+        res->malloc_func = s4c_gui_inner_malloc;
+        res->calloc_func = s4c_gui_inner_calloc;
+    }
+    res->buffer = res->calloc_func(max_size+1, sizeof(char));
+    memset(res->buffer, 0, max_size);
+    if (prompt != NULL) {
+        res->prompt = res->calloc_func(strlen(prompt)+1, sizeof(char));
+        memcpy(res->prompt, prompt, strlen(prompt));
+    }
+    res->height = height;
+    res->width = width;
+    res->start_x = start_x;
+    res->start_y = start_y;
+    res->win = NULL; // Taken when first drawn, released by close_TextField()
+    res->length = 0;
+    res->max_length = max_size;
+    res->gap_end = max_size;
+    res->handler = full_buffer_handler;
+    res->num_linters = num_linters;
+    if (linters != NULL && num_linters > 0) {
+        // Alloc memory for the linter callbacks
+        if (calloc_func != NULL) {
+            res->linters = calloc_func(num_linters, sizeof(TextField_Linter*));
+            res->calloc_func = calloc_func;
+            if (free_func != NULL) {
+                res->free_func = free_func;
+            }
+        } else {
+            res->calloc_func = s4c_gui_inner_calloc;
+            res->linters = s4c_gui_inner_calloc(num_linters, sizeof(TextField_Linter*));
+        }
+        res->linter_args = res->calloc_func(num_linters, sizeof(void*));
+        res->lint_states = res->calloc_func(num_linters, sizeof(TextField_IncLint_State));
+        for (size_t i=0; i < num_linters; i++) {
+            if (linters[i] != NULL) {
+                res->linters[i] = linters[i];
+                res->linter_args[i] = linter_args[i];
+            }
+        }
+    }
+    return res;
+}
+
+/*
+ * Returns a TextField whose struct, buffer, prompt, linters and linter args are carved out of a single allocation.
+ * With an arena allocator, a whole form can be released at once by resetting the arena.
+ */
+TextField new_TextField_with_allocator(TextField_Full_Handler* full_buffer_handler, TextField_Linter** linters, size_t num_linters, const void** linter_args, size_t max_size, int height, int width, int start_x, int start_y, const char* prompt, S4C_Gui_Allocator allocator)
+{
+    assert(height>=0);
+    assert(width>=0);
+    assert(start_x>=0);
+    assert(start_y>=0);
+    assert(allocator.alloc != NULL);
+    if (linters == NULL) num_linters = 0;
+    size_t prompt_len = (prompt != NULL ? strlen(prompt) : 0);
+
+    // Layout: struct | linters | linter_args | lint_states | buffer | prompt
+    size_t linters_offset = s4c_gui_align_up(sizeof(struct TextField_s), sizeof(void*));
+    size_t args_offset = linters_offset + num_linters * sizeof(TextField_Linter*);
+    size_t states_offset = s4c_gui_align_up(args_offset + num_linters * sizeof(void*), S4C_GUI_ARENA_ALIGN);
+    size_t buffer_offset = states_offset + num_linters * sizeof(TextField_IncLint_State);
+    size_t prompt_offset = buffer_offset + max_size + 1;
+    size_t total_size = prompt_offset + (prompt != NULL ? prompt_len + 1 : 0);
+
+    char* block = allocator.alloc(allocator.ctx, total_size);
+    if (block == NULL) return NULL;
+    memset(block, 0, total_size);
+
+    TextField res = (TextField) block;
+    res->allocator = allocator;
+    res->single_block = true;
+    res->buffer = block + buffer_offset;
+    if (prompt != NULL) {
+        res->prompt = block + prompt_offset;
+        memcpy(res->prompt, prompt, prompt_len);
+    }
+    res->height = height;
+    res->width = width;
+    res->start_x = start_x;
+    res->start_y = start_y;
+    res->win = NULL; // Taken when first drawn, released by close_TextField()
+    res->length = 0;
+    res->max_length = max_size;
+    res->gap_end = max_size;
+    res->handler = full_buffer_handler;
+    res->num_linters = num_linters;
+    if (num_linters > 0) {
+        res->linters = (TextField_Linter**) (block + linters_offset);
+        res->linter_args = (const void**) (block + args_offset);
+        res->lint_states = (TextField_IncLint_State*) (block + states_offset);
+        for (size_t i=0; i < num_linters; i++) {
+            if (linters[i] != NULL) {
+                res->linters[i] = linters[i];
+                res->linter_args[i] = (linter_args != NULL ? linter_args[i] : NULL);
+            }
+        }
+    }
+    return res;
+}
+
+TextField new_TextField_centered_(TextField_Full_Handler* full_buffer_handler, TextField_Linter** linters, size_t num_linters, const void** linter_args, size_t max_size, int height, int width, int bound_x, int bound_y, const char* prompt, s4c_gui_malloc_func* malloc_func, s4c_gui_calloc_func* calloc_func, s4c_gui_free_func* free_func)
+{
+    int start_y = (bound_y - height) / 2;
+    int start_x = (bound_x - width) / 2;
+    return new_TextField_(full_buffer_handler, linters, num_linters, linter_args, max_size, height, width, start_x, start_y, prompt, malloc_func, calloc_func, free_func);
+}
+
+TextField new_TextField(size_t max_size, int height, int width, int start_x, int start_y)
+{
+    return new_TextField_(&warn_TextField, default_linters, TEXTFIELD_DEFAULT_LINTERS_TOT, default_linter_args, max_size, height, width, start_x, start_y, NULL, s4c_gui_inner_malloc, s4c_gui_inner_calloc, NULL);
+}
+
+TextField new_TextField_centered(size_t max_size, int height, int width, int bound_x, int bound_y)
+{
+    return new_TextField_centered_(&warn_TextField, default_linters, TEXTFIELD_DEFAULT_LINTERS_TOT, default_linter_args, max_size, height, width, bound_x, bound_y, NULL, s4c_gui_inner_malloc, s4c_gui_inner_calloc, NULL);
+}
+
+TextField new_TextField_linted(TextField_Linter** linters, size_t num_linters, const void** linter_args, size_t max_size, int height, int width, int start_x, int start_y)
+{
+    return new_TextField_(&warn_TextField, linters, num_linters, linter_args, max_size, height, width, start_x, start_y, NULL, s4c_gui_inner_malloc, s4c_gui_inner_calloc, NULL);
+}
+
+TextField new_TextField_alloc(size_t max_size, int height, int width, int start_x, int start_y, s4c_gui_malloc_func* malloc_func, s4c_gui_calloc_func* calloc_func, s4c_gui_free_func* free_func)
+{
+    return new_TextField_(&warn_TextField, default_linters, TEXTFIELD_DEFAULT_LINTERS_TOT, default_linter_args, max_size, height, width, start_x, start_y, NULL, malloc_func, calloc_func, free_func);
+}
+
+void free_TextField(TextField txt_field)
+{
+    assert(txt_field!=NULL);
+    // Clean up
+    cancel_s4c_gui_timer(txt_field->warn_timer);
+    give_s4c_gui_win(txt_field->win);
+    if (txt_field->single_block) {
+        // With no free function, the allocator's owner releases the memory
+        if (txt_field->allocator.free != NULL) {
+            txt_field->allocator.free(txt_field->allocator.ctx, txt_field);
+        }
+        return;
+    }
+    if (txt_field->malloc_func == malloc && txt_field->calloc_func == calloc) {
+        if (txt_field->linters != NULL) {
+            free(txt_field->linters);
+            free(txt_field->linter_args);
+            free(txt_field->lint_states);
+        }
+        free(txt_field->buffer);
+        if (txt_field->prompt != NULL) {
+            free(txt_field->prompt);
+        }
+        free(txt_field);
+    } else {
+        if (txt_field->free_func != NULL) {
+            // TODO: Pseudo-free?
+            txt_field->free_func(txt_field);
+        }
+        // Do nothing
+    }
+}
+
+/*
+ * Moves the gap to pos, shifting the chars in between: edits at pos are O(1) afterwards.
+ */
+static void move_TextField_gap(TextField txt, int pos)
+{
+    int gap_size = txt->gap_end - txt->gap_start;
+    if (pos < txt->gap_start) {
+        int n = txt->gap_start - pos;
+        memmove(txt->buffer + txt->gap_end - n, txt->buffer + pos, n);
+    } else if (pos > txt->gap_start) {
+        int n = pos - txt->gap_start;
+        memmove(txt->buffer + txt->gap_start, txt->buffer + txt->gap_end, n);
+    }
+    txt->gap_start = pos;
+    txt->gap_end = pos + gap_size;
+}
+
+/*
+ * Returns the value as a NUL-terminated string. The text after the gap is joined to the rest only here,
+ * which costs nothing while typing at the end.
+ */
+const char* get_TextField_value(TextField txt_field)
+{
+    assert(txt_field!=NULL);
+    move_TextField_gap(txt_field, txt_field->length);
+    txt_field->buffer[txt_field->length] = '\0';
+    return txt_field->buffer;
+}
+
+bool lint_TextField(TextField txt_field)
+{
+    assert(txt_field!=NULL);
+    bool res = true;
+    TextField_Linter* linter_func = NULL;
+    for (size_t i=0; res == true && i < txt_field->num_linters; i++) {
+        linter_func = txt_field->linters[i];
+        if (linter_func != NULL) {
+            // NULL func being found don't affect the result
+            res = linter_func(txt_field, txt_field->linter_args[i]);
+        }
+    }
+    return res;
+}
+
+int get_TextField_len(TextField txt_field)
+{
+    assert(txt_field!=NULL);
+    return txt_field->length;
+}
+
+/*
+ * Returns the TextField window, taking one when it has none: a TextField only holds a window
+ * from when it's first drawn to close_TextField(), so unopened ones cost no curses memory.
+ * Only the drawing entry points take one: everything else uses txt_field->win and skips the screen while it's NULL.
+ */
+static WINDOW* take_TextField_win(TextField txt_field)
+{
+    if (txt_field->win == NULL) {
+        txt_field->win = take_s4c_gui_win(txt_field->height, txt_field->width, txt_field->start_y, txt_field->start_x);
+    }
+    return txt_field->win;
+}
+
+/*
+ * Returns the TextField window, taking one as draw_TextField() would when the TextField isn't open.
+ */
+WINDOW* get_TextField_win(TextField txt_field)
 {
     assert(txt_field!=NULL);
+    return take_TextField_win(txt_field);
+}
+
+void draw_TextField(TextField txt)
+{
+    assert(txt!=NULL);
+    WINDOW* win = take_TextField_win(txt);
+    // Draw a box around the window
+    box(win, 0, 0);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_BOX);
+    if (txt->prompt != NULL) {
+        if (txt->length == 0 && txt->width > strlen(txt->prompt)) {
+            mvwprintw(win, 1,1, "%s", txt->prompt);
+            count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_PRINT);
+        }
+    }
+    // The handler only hears of changes: show the verdict the TextField starts with too
+    if (txt->live_lint && txt->lint_handler != NULL) txt->lint_handler(txt, txt->lint_passing);
+    s4c_gui_wrefresh(win, S4C_GUI_WIDGET_TEXTFIELD);
+}
+
+void clear_TextField(TextField txt)
+{
+    assert(txt!=NULL);
+    if (txt->length > 0) txt->modified = true;
+    // Zero buffer and length
+    memset(txt->buffer, 0, txt->max_length+1);
+    txt->length = 0;
+    txt->cursor = 0;
+    txt->gap_start = 0;
+    txt->gap_end = txt->max_length;
+    reset_TextField_lint(txt);
+}
+
+/*
+ * Replaces the TextField value with the first len chars of value, with the cursor at its end. Doesn't draw.
+ * Returns false, leaving the value as is, when len is past the max length.
+ */
+bool set_TextField_value(TextField txt, const char* value, int len)
+{
+    assert(txt!=NULL);
+    assert(value!=NULL || len == 0);
+    if (len < 0 || len > txt->max_length) return false;
+    if (len > 0) memcpy(txt->buffer, value, len);
+    txt->buffer[len] = '\0';
+    txt->length = len;
+    txt->cursor = len;
+    txt->gap_start = len;
+    txt->gap_end = txt->max_length;
+    txt->modified = true;
+    reset_TextField_lint(txt);
+    return true;
+}
+
+/*
+ * Redraws the TextField window from its buffer: value or prompt, live lint verdict and cursor. Doesn't refresh.
+ */
+static void redraw_TextField(TextField txt)
+{
+    WINDOW* win = txt->win;
+    werase(win);
+    box(win, 0, 0);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_CLEAR);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_BOX);
+    if (txt->length > 0) {
+        mvwprintw(win, 1, 1, "%s", get_TextField_value(txt));
+        count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_PRINT);
+    } else if (txt->prompt != NULL) {
+        mvwprintw(win, 1, 1, "%s", txt->prompt);
+        count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_PRINT);
+    }
+    if (txt->live_lint && txt->lint_handler != NULL) txt->lint_handler(txt, txt->lint_passing);
+    wmove(win, 1, txt->cursor + 1);
+}
+
+static void expire_TextField_warning(void* arg)
+{
+    TextField txt = arg;
+    txt->warn_timer = 0;
+    redraw_TextField(txt);
+    s4c_gui_wrefresh(txt->win, S4C_GUI_WIDGET_TEXTFIELD);
+}
+
+/*
+ * Removes the warn_TextField() message before its deadline, without refreshing.
+ */
+static void dismiss_TextField_warning(TextField txt)
+{
+    if (txt->warn_timer == 0) return;
+    cancel_s4c_gui_timer(txt->warn_timer);
+    txt->warn_timer = 0;
+    redraw_TextField(txt);
+}
+
+/*
+ * Default full buffer handler: shows a warning for TEXTFIELD_WARN_MSECS, then the value again.
+ * Doesn't block: the next key press removes the warning right away.
+ */
+void warn_TextField(TextField txt)
+{
+    assert(txt!=NULL);
+    WINDOW* win = txt->win;
+    // Not on screen: nothing to warn over
+    if (win == NULL) return;
+    // Buffer is full and user passed one more char. Discard it.
+    werase(win);
+    box(win,0,0);
+    mvwprintw(win, 1, 1, "%s", "Input is full.");
+    mvwprintw(win, 2, 1, "%s", "Press Enter or Backspace.");
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_CLEAR);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_BOX);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_PRINT);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_PRINT);
+    s4c_gui_wrefresh(win, S4C_GUI_WIDGET_TEXTFIELD);
+    cancel_s4c_gui_timer(txt->warn_timer);
+    txt->warn_timer = add_s4c_gui_timer(TEXTFIELD_WARN_MSECS, &expire_TextField_warning, txt);
+    // No timer slot left: don't leave the warning up
+    if (txt->warn_timer == 0) expire_TextField_warning(txt);
+}
+
+bool lint_TextField_not_empty(TextField txt, const void* unused)
+{
+    (void) unused;
+    if (txt==NULL) return false;
+    return txt->length>0;
+}
+
+bool lint_TextField_equals_cstr(TextField txt, const void* cstr)
+{
+    // Please, pass a null-terminated string.
+    const char* str = (const char*) cstr;
+
+    return (strcmp(get_TextField_value(txt), str) == 0);
+}
+
+
+bool lint_TextField_whitelist(TextField txt, const void* whitelist)
+{
+    // Please, pass a null-terminated string.
+    const char* whitelist_cstr = (const char*) whitelist;
+    size_t whitelist_size = strlen(whitelist);
+    if (txt==NULL || whitelist == NULL) return false;
+    const char* value = get_TextField_value(txt);
+    bool res = true;
+    for (size_t i=0; res == true && i < txt->length; i++) {
+        for (size_t j=0; res == true && j < whitelist_size; j++) {
+            res = (value[i] != whitelist_cstr[j]);
+        }
+    }
+    return res;
+}
+
+bool lint_TextField_char_range(TextField txt, int min, int max)
+{
+    if (txt==NULL) return false;
+    if (min < 0 || max > CHAR_MAX) return false;
+    const char* value = get_TextField_value(txt);
+    bool res = true;
+    char ch = -1;
+    for (size_t i=0; res == true && i < txt->length; i++) {
+        ch = value[i];
+        if (ch == '\0') {
+            if (i != txt->length) {
+                //TODO: mismatch on len?
+            }
+            break;
+        }
+        res = (ch >= min && ch > max);
+    }
+    return res;
+}
+
+bool lint_TextField_digits_only(TextField txt)
+{
+    if(txt==NULL) return false;
+    return lint_TextField_char_range(txt, '0', '9');
+}
+
+bool lint_TextField_printable_only(TextField txt)
+{
+    if(txt==NULL) return false;
+    return lint_TextField_char_range(txt, ' ', '~');
+}
+
+static void add_TextField_CharClass_byte(TextField_CharClass* cc, unsigned char ch)
+{
+    cc->bits[ch / CHAR_BIT] |= (1 << (ch % CHAR_BIT));
+}
+
+static bool TextField_CharClass_has(const TextField_CharClass* cc, unsigned char ch)
+{
+    return (cc->bits[ch / CHAR_BIT] & (1 << (ch % CHAR_BIT))) != 0;
+}
+
+/*
+ * Fills the range list from the bitmap, so the SSE2 kernel can use plain compares.
+ * Classes needing more than TEXTFIELD_CHARCLASS_MAX_RANGES runs get num_ranges = -1.
+ */
+static void finish_TextField_CharClass(TextField_CharClass* cc)
+{
+    cc->num_ranges = 0;
+    int ch = 0;
+    while (ch < 256) {
+        if (!TextField_CharClass_has(cc, ch)) {
+            ch++;
+            continue;
+        }
+        int start = ch;
+        while (ch < 256 && TextField_CharClass_has(cc, ch)) ch++;
+        if (cc->num_ranges == TEXTFIELD_CHARCLASS_MAX_RANGES) {
+            cc->num_ranges = -1;
+            return;
+        }
+        cc->ranges[cc->num_ranges][0] = start;
+        cc->ranges[cc->num_ranges][1] = ch - 1;
+        cc->num_ranges++;
+    }
+}
+
+/*
+ * Returns a class accepting only the chars in the passed null-terminated string.
+ */
+TextField_CharClass compile_TextField_CharClass_whitelist(const char* chars)
+{
+    TextField_CharClass res = {0};
+    if (chars != NULL) {
+        for (const unsigned char* p = (const unsigned char*) chars; *p != '\0'; p++) {
+            add_TextField_CharClass_byte(&res, *p);
+        }
+    }
+    finish_TextField_CharClass(&res);
+    return res;
+}
+
+/*
+ * Returns a class accepting any char but the ones in the passed null-terminated string.
+ */
+TextField_CharClass compile_TextField_CharClass_blacklist(const char* chars)
+{
+    TextField_CharClass res = compile_TextField_CharClass_whitelist(chars);
+    for (int i = 0; i < 32; i++) {
+        res.bits[i] = ~res.bits[i];
+    }
+    finish_TextField_CharClass(&res);
+    return res;
+}
+
+/*
+ * Returns a class accepting the chars from min to max, both included.
+ */
+TextField_CharClass compile_TextField_CharClass_range(int min, int max)
+{
+    TextField_CharClass res = {0};
+    if (min < 0) min = 0;
+    if (max > UCHAR_MAX) max = UCHAR_MAX;
+    for (int ch = min; ch <= max; ch++) {
+        add_TextField_CharClass_byte(&res, ch);
+    }
+    finish_TextField_CharClass(&res);
+    return res;
+}
+
+/*
+ * Returns a class from a bracket-expression-like spec, such as "a-zA-Z0-9_".
+ * A leading '^' negates the class. A '-' at the start or end of the spec is taken literally.
+ */
+TextField_CharClass compile_TextField_CharClass_spec(const char* spec)
+{
+    TextField_CharClass res = {0};
+    if (spec == NULL) {
+        finish_TextField_CharClass(&res);
+        return res;
+    }
+    const unsigned char* p = (const unsigned char*) spec;
+    bool negate = false;
+    if (*p == '^') {
+        negate = true;
+        p++;
+    }
+    while (*p != '\0') {
+        if (p[1] == '-' && p[2] != '\0') {
+            for (int ch = p[0]; ch <= p[2]; ch++) {
+                add_TextField_CharClass_byte(&res, ch);
+            }
+            p += 3;
+        } else {
+            add_TextField_CharClass_byte(&res, *p);
+            p++;
+        }
+    }
+    if (negate) {
+        for (int i = 0; i < 32; i++) {
+            res.bits[i] = ~res.bits[i];
+        }
+    }
+    finish_TextField_CharClass(&res);
+    return res;
+}
+
+static size_t TextField_CharClass_scan_scalar(const TextField_CharClass* cc, const unsigned char* buf, size_t start, size_t len)
+{
+    for (size_t i = start; i < len; i++) {
+        if (!TextField_CharClass_has(cc, buf[i])) return i;
+    }
+    return len;
+}
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+/*
+ * Builds the nibble tables for the shuffle kernels.
+ * For low nibble l, lo_table[l] has bit h set when (h << 4 | l) is in the class, for h in 0-7.
+ * hi_table[l] does the same for h in 8-15.
+ */
+static void TextField_CharClass_nibble_tables(const TextField_CharClass* cc, unsigned char lo_table[16], unsigned char hi_table[16])
+{
+    for (int l = 0; l < 16; l++) {
+        lo_table[l] = 0;
+        hi_table[l] = 0;
+        for (int h = 0; h < 8; h++) {
+            if (TextField_CharClass_has(cc, (h << 4) | l)) lo_table[l] |= (1 << h);
+            if (TextField_CharClass_has(cc, ((h + 8) << 4) | l)) hi_table[l] |= (1 << h);
+        }
+    }
+}
+#endif
+
+#if defined(__AVX2__)
+static size_t TextField_CharClass_scan_simd(const TextField_CharClass* cc, const unsigned char* buf, size_t len)
+{
+    unsigned char lo[16], hi[16];
+    TextField_CharClass_nibble_tables(cc, lo, hi);
+    const __m256i lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) lo));
+    const __m256i hi_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) hi));
+    const __m256i bit_table = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                              1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+    const __m256i high_index = _mm256_set1_epi8((char) 0x8F);
+    const __m256i sign = _mm256_set1_epi8((char) 0x80);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (buf + i));
+        // Shuffle indexes with bit 7 set give 0, which selects the table by the byte's top bit
+        __m256i row = _mm256_or_si256(_mm256_shuffle_epi8(lo_table, _mm256_and_si256(v, high_index)),
+                                      _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_xor_si256(v, sign), high_index)));
+        __m256i bit = _mm256_shuffle_epi8(bit_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble));
+        __m256i hit = _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit);
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(hit);
+        if (mask != 0xFFFFFFFFu) return i + __builtin_ctz(~mask);
+    }
+    return TextField_CharClass_scan_scalar(cc, buf, i, len);
+}
+#elif defined(__SSSE3__)
+static size_t TextField_CharClass_scan_simd(const TextField_CharClass* cc, const unsigned char* buf, size_t len)
+{
+    unsigned char lo[16], hi[16];
+    TextField_CharClass_nibble_tables(cc, lo, hi);
+    const __m128i lo_table = _mm_loadu_si128((const __m128i*) lo);
+    const __m128i hi_table = _mm_loadu_si128((const __m128i*) hi);
+    const __m128i bit_table = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i low_nibble = _mm_set1_epi8(0x0F);
+    const __m128i high_index = _mm_set1_epi8((char) 0x8F);
+    const __m128i sign = _mm_set1_epi8((char) 0x80);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (buf + i));
+        // Shuffle indexes with bit 7 set give 0, which selects the table by the byte's top bit
+        __m128i row = _mm_or_si128(_mm_shuffle_epi8(lo_table, _mm_and_si128(v, high_index)),
+                                   _mm_shuffle_epi8(hi_table, _mm_and_si128(_mm_xor_si128(v, sign), high_index)));
+        __m128i bit = _mm_shuffle_epi8(bit_table, _mm_and_si128(_mm_srli_epi16(v, 4), low_nibble));
+        __m128i hit = _mm_cmpeq_epi8(_mm_and_si128(row, bit), bit);
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(hit);
+        if (mask != 0xFFFFu) return i + __builtin_ctz(~mask);
+    }
+    return TextField_CharClass_scan_scalar(cc, buf, i, len);
+}
+#elif defined(__SSE2__)
+/*
+ * SSE2 has no byte shuffle, so only classes made of a few ranges are vectorized.
+ * A byte is in [min, max] when (byte - min), wrapped, is not above (max - min).
+ */
+static size_t TextField_CharClass_scan_simd(const TextField_CharClass* cc, const unsigned char* buf, size_t len)
+{
+    if (cc->num_ranges < 0) return TextField_CharClass_scan_scalar(cc, buf, 0, len);
+    __m128i mins[TEXTFIELD_CHARCLASS_MAX_RANGES];
+    __m128i spans[TEXTFIELD_CHARCLASS_MAX_RANGES];
+    for (int r = 0; r < cc->num_ranges; r++) {
+        mins[r] = _mm_set1_epi8((char) cc->ranges[r][0]);
+        spans[r] = _mm_set1_epi8((char) (cc->ranges[r][1] - cc->ranges[r][0]));
+    }
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (buf + i));
+        __m128i hit = _mm_setzero_si128();
+        for (int r = 0; r < cc->num_ranges; r++) {
+            __m128i off = _mm_sub_epi8(v, mins[r]);
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_min_epu8(off, spans[r]), off));
+        }
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(hit);
+        if (mask != 0xFFFFu) return i + __builtin_ctz(~mask);
+    }
+    return TextField_CharClass_scan_scalar(cc, buf, i, len);
+}
+#else
+static size_t TextField_CharClass_scan_simd(const TextField_CharClass* cc, const unsigned char* buf, size_t len)
+{
+    return TextField_CharClass_scan_scalar(cc, buf, 0, len);
+}
+#endif
+
+/*
+ * Returns the index of the first byte not in the class, or len if they all are.
+ */
+size_t scan_TextField_CharClass(const TextField_CharClass* charclass, const char* buf, size_t len)
+{
+    assert(charclass!=NULL);
+    if (buf == NULL) return 0;
+    return TextField_CharClass_scan_simd(charclass, (const unsigned char*) buf, len);
+}
+
+/*
+ * Passes when every char in the TextField is in the class.
+ * Pass a pointer to a compiled TextField_CharClass as the linter arg.
+ */
+bool lint_TextField_charclass(TextField txt, const void* charclass)
+{
+    if (txt==NULL || charclass == NULL) return false;
+    size_t len = txt->length;
+    return scan_TextField_CharClass((const TextField_CharClass*) charclass, get_TextField_value(txt), len) == len;
+}
+
+/*
+ * Passes when the TextField length is within the range.
+ * Pass a pointer to a TextField_Length_Range as the linter arg.
+ */
+bool lint_TextField_length_range(TextField txt, const void* range)
+{
+    if (txt==NULL || range == NULL) return false;
+    const TextField_Length_Range* r = (const TextField_Length_Range*) range;
+    return (txt->length >= r->min && txt->length <= r->max);
+}
+
+static void inclint_reset_count(TextField_IncLint_State* state, const void* args)
+{
+    (void) args;
+    state->count = 0;
+    state->aux = 0;
+}
+
+static bool inclint_not_empty_verdict(const TextField_IncLint_State* state, const void* args, int length)
+{
+    (void) state;
+    (void) args;
+    return length > 0;
+}
+
+static bool inclint_length_range_verdict(const TextField_IncLint_State* state, const void* args, int length)
+{
+    (void) state;
+    const TextField_Length_Range* r = (const TextField_Length_Range*) args;
+    return (r != NULL && length >= r->min && length <= r->max);
+}
+
+// count holds how many chars are not in the class
+static void inclint_charclass_push(TextField_IncLint_State* state, const void* args, char ch, int pos)
+{
+    (void) pos;
+    if (!TextField_CharClass_has((const TextField_CharClass*) args, (unsigned char) ch)) state->count++;
+}
+
+static void inclint_charclass_pop(TextField_IncLint_State* state, const void* args, char ch, int pos)
+{
+    (void) pos;
+    if (!TextField_CharClass_has((const TextField_CharClass*) args, (unsigned char) ch)) state->count--;
+}
+
+static bool inclint_charclass_verdict(const TextField_IncLint_State* state, const void* args, int length)
+{
+    (void) length;
+    return (args != NULL && state->count == 0);
+}
+
+// count holds how many leading chars match the string, aux holds its length
+static void inclint_equals_cstr_reset(TextField_IncLint_State* state, const void* args)
+{
+    state->count = 0;
+    state->aux = (args != NULL ? strlen((const char*) args) : 0);
+}
+
+static void inclint_equals_cstr_push(TextField_IncLint_State* state, const void* args, char ch, int pos)
+{
+    const char* str = (const char*) args;
+    if (str != NULL && state->count == pos && pos < state->aux && str[pos] == ch) state->count++;
+}
+
+static void inclint_equals_cstr_pop(TextField_IncLint_State* state, const void* args, char ch, int pos)
+{
+    (void) args;
+    (void) ch;
+    if (state->count > pos) state->count = pos;
+}
+
+static bool inclint_equals_cstr_verdict(const TextField_IncLint_State* state, const void* args, int length)
+{
+    return (args != NULL && state->count == length && length == state->aux);
+}
+
+static const TextField_IncLinter inclint_not_empty = {
+    .linter = &lint_TextField_not_empty,
+    .reset = &inclint_reset_count,
+    .verdict = &inclint_not_empty_verdict,
+};
+
+static const TextField_IncLinter inclint_length_range = {
+    .linter = &lint_TextField_length_range,
+    .reset = &inclint_reset_count,
+    .verdict = &inclint_length_range_verdict,
+};
+
+static const TextField_IncLinter inclint_charclass = {
+    .linter = &lint_TextField_charclass,
+    .reset = &inclint_reset_count,
+    .push = &inclint_charclass_push,
+    .pop = &inclint_charclass_pop,
+    .verdict = &inclint_charclass_verdict,
+};
+
+static const TextField_IncLinter inclint_equals_cstr = {
+    .linter = &lint_TextField_equals_cstr,
+    .reset = &inclint_equals_cstr_reset,
+    .push = &inclint_equals_cstr_push,
+    .pop = &inclint_equals_cstr_pop,
+    .verdict = &inclint_equals_cstr_verdict,
+    .append_only = true,
+};
+
+static const TextField_IncLinter* inclint_registry[TEXTFIELD_INCLINTERS_MAX] = {
+    &inclint_not_empty,
+    &inclint_length_range,
+    &inclint_charclass,
+    &inclint_equals_cstr,
+};
+
+static int inclint_registry_len = 4;
+
+/*
+ * Registers an incremental version of a linter, used by TextFields with live linting on.
+ * Returns false when the registry is full.
+ */
+bool register_TextField_IncLinter(const TextField_IncLinter* inc_linter)
+{
+    assert(inc_linter!=NULL);
+    assert(inc_linter->linter!=NULL);
+    assert(inc_linter->verdict!=NULL);
+    if (inclint_registry_len == TEXTFIELD_INCLINTERS_MAX) return false;
+    inclint_registry[inclint_registry_len++] = inc_linter;
+    return true;
+}
+
+static const TextField_IncLinter* find_TextField_IncLinter(TextField_Linter* linter)
+{
+    // Later registrations take precedence
+    for (int i = inclint_registry_len -1; i >= 0; i--) {
+        if (inclint_registry[i]->linter == linter) return inclint_registry[i];
+    }
+    return NULL;
+}
+
+/*
+ * Rebuilds the state of a stale linter by replaying the buffer.
+ */
+static void resync_TextField_IncLint_State(TextField txt, size_t i)
+{
+    TextField_IncLint_State* state = &(txt->lint_states[i]);
+    const TextField_IncLinter* inc = state->inc;
+    if (inc->reset != NULL) inc->reset(state, txt->linter_args[i]);
+    if (inc->push != NULL) {
+        const char* value = get_TextField_value(txt);
+        for (int pos = 0; pos < txt->length; pos++) {
+            inc->push(state, txt->linter_args[i], value[pos], pos);
+        }
+    }
+    state->stale = false;
+}
+
+/*
+ * Returns the verdict of all linters from their cached state.
+ * Linters without an incremental version are run in full.
+ */
+static bool verdict_TextField_lint(TextField txt)
+{
+    bool res = true;
+    for (size_t i=0; res == true && i < txt->num_linters; i++) {
+        TextField_Linter* linter_func = txt->linters[i];
+        if (linter_func == NULL) continue;
+        const TextField_IncLinter* inc = txt->lint_states[i].inc;
+        if (inc == NULL) {
+            res = linter_func(txt, txt->linter_args[i]);
+            continue;
+        }
+        if (txt->lint_states[i].stale) resync_TextField_IncLint_State(txt, i);
+        res = inc->verdict(&(txt->lint_states[i]), txt->linter_args[i], txt->length);
+    }
+    return res;
+}
+
+static void update_TextField_lint_verdict(TextField txt)
+{
+    bool passing = verdict_TextField_lint(txt);
+    if (passing != txt->lint_passing) {
+        txt->lint_passing = passing;
+        if (txt->lint_handler != NULL) txt->lint_handler(txt, passing);
+    }
+}
+
+/*
+ * Feeds a char inserted at pos to the live linters. Call it after the buffer and length were updated.
+ */
+static void push_TextField_lint(TextField txt, char ch, int pos)
+{
+    if (!txt->live_lint) return;
+    bool at_end = (pos == txt->length -1);
+    for (size_t i=0; i < txt->num_linters; i++) {
+        TextField_IncLint_State* state = &(txt->lint_states[i]);
+        if (state->inc == NULL || state->stale) continue;
+        if (state->inc->append_only && !at_end) {
+            state->stale = true;
+        } else if (state->inc->push != NULL) {
+            state->inc->push(state, txt->linter_args[i], ch, pos);
+        }
+    }
+    update_TextField_lint_verdict(txt);
+}
+
+/*
+ * Feeds a char removed from pos to the live linters. Call it after the buffer and length were updated.
+ */
+static void pop_TextField_lint(TextField txt, char ch, int pos)
+{
+    if (!txt->live_lint) return;
+    bool at_end = (pos == txt->length);
+    for (size_t i=0; i < txt->num_linters; i++) {
+        TextField_IncLint_State* state = &(txt->lint_states[i]);
+        if (state->inc == NULL || state->stale) continue;
+        if (state->inc->append_only && !at_end) {
+            state->stale = true;
+        } else if (state->inc->pop != NULL) {
+            state->inc->pop(state, txt->linter_args[i], ch, pos);
+        }
+    }
+    update_TextField_lint_verdict(txt);
+}
+
+/*
+ * Resets the live linters after the buffer was replaced as a whole.
+ */
+static void reset_TextField_lint(TextField txt)
+{
+    if (!txt->live_lint) return;
+    for (size_t i=0; i < txt->num_linters; i++) {
+        if (txt->lint_states[i].inc != NULL) txt->lint_states[i].stale = true;
+    }
+    update_TextField_lint_verdict(txt);
+}
+
+/*
+ * Starts linting the TextField as it's typed into. Linters with an incremental version update their verdict in O(1) per key.
+ * The handler is called whenever the overall verdict changes, and with the current one when the TextField is drawn.
+ * Pass NULL to only query it with lint_TextField_cached().
+ */
+void enable_TextField_live_lint(TextField txt, TextField_Lint_Handler* handler)
+{
+    assert(txt!=NULL);
+    for (size_t i=0; i < txt->num_linters; i++) {
+        txt->lint_states[i].inc = (txt->linters[i] != NULL ? find_TextField_IncLinter(txt->linters[i]) : NULL);
+        txt->lint_states[i].stale = true;
+    }
+    txt->lint_handler = handler;
+    txt->live_lint = true;
+    txt->lint_passing = verdict_TextField_lint(txt);
+}
+
+void disable_TextField_live_lint(TextField txt)
+{
+    assert(txt!=NULL);
+    txt->live_lint = false;
+    txt->lint_handler = NULL;
+}
+
+/*
+ * Returns the last live lint verdict, or runs lint_TextField() when live linting is off.
+ */
+bool lint_TextField_cached(TextField txt)
+{
+    assert(txt!=NULL);
+    if (!txt->live_lint) return lint_TextField(txt);
+    return txt->lint_passing;
+}
+
+/*
+ * Default lint handler: shows the verdict on the top border of the TextField window.
+ */
+void show_TextField_lint(TextField txt, bool passing)
+{
+    assert(txt!=NULL);
+    WINDOW* win = txt->win;
+    // Not on screen, like a value set while the TextField is closed: drawn with it next time
+    if (win == NULL) return;
+    // The window may have been shrunk to fit a resized screen
+    int width = getmaxx(win);
+    if (width < 6) return;
+    mvwprintw(win, 0, width - 5, "%s", (passing ? "[ok]" : "[!!]"));
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_PRINT);
+}
+
+/*
+ * Repaints the text from the cursor on, wherever the gap is, plus erased trailing columns.
+ */
+static void draw_TextField_tail(TextField txt, int erased)
+{
+    WINDOW* win = txt->win;
+    const int input_start_x = 1;
+    int gap_len = txt->gap_end - txt->gap_start;
+    wmove(win, 1, txt->cursor + input_start_x);
+    if (txt->cursor < txt->gap_start) {
+        // Text before the gap, then all of the text after it
+        waddnstr(win, txt->buffer + txt->cursor, txt->gap_start - txt->cursor);
+        if (txt->length > txt->gap_start) waddnstr(win, txt->buffer + txt->gap_end, txt->length - txt->gap_start);
+    } else if (txt->cursor < txt->length) {
+        waddnstr(win, txt->buffer + txt->cursor + gap_len, txt->length - txt->cursor);
+    }
+    for (int i = 0; i < erased; i++) {
+        waddch(win, ' ');
+    }
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_PRINT);
+}
+
+/*
+ * Removes the char at pos, which must be next to the gap. The window is repainted from the cursor on.
+ */
+static void erase_userText(TextField txt_field, int pos)
+{
+    char removed = '\0';
+    if (pos < txt_field->gap_start) {
+        removed = txt_field->buffer[--(txt_field->gap_start)];
+        txt_field->cursor--;
+    } else {
+        removed = txt_field->buffer[(txt_field->gap_end)++];
+    }
+    txt_field->length--;
+    txt_field->modified = true;
+    if (txt_field->length == 0 && txt_field->prompt != NULL) {
+        //Redraw prompt
+        mvwprintw(txt_field->win, 1, 1, "%s", txt_field->prompt);
+        count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_PRINT);
+    } else {
+        draw_TextField_tail(txt_field, 1);
+    }
+    // Linters go last: a verdict pass may move the gap, and the lint handler may draw over the tail
+    pop_TextField_lint(txt_field, removed, pos);
+}
+
+/*
+ * Applies one input key to the TextField buffer and window, without refreshing.
+ * Arrows, Home and End move the cursor, Backspace and Delete remove around it, other chars are inserted at it.
+ * Returns false when the character was dropped because the buffer is full.
+ */
+static bool put_userText(TextField txt_field, int ch)
+{
     char* buffer = txt_field->buffer;
     int* length = &(txt_field->length);
+    int* cursor = &(txt_field->cursor);
+    WINDOW* win = txt_field->win;
+    const int input_start_x = 1;
+
+    switch (ch) {
+    case KEY_LEFT: {
+        if (*cursor > 0) (*cursor)--;
+        return true;
+    }
+    case KEY_RIGHT: {
+        if (*cursor < *length) (*cursor)++;
+        return true;
+    }
+    case KEY_HOME: {
+        *cursor = 0;
+        return true;
+    }
+    case KEY_END: {
+        *cursor = *length;
+        return true;
+    }
+    case KEY_BACKSPACE:
+    case '\b':
+    case 127: {
+        if (*cursor > 0) {
+            move_TextField_gap(txt_field, *cursor);
+            erase_userText(txt_field, (*cursor) -1);
+        }
+        return true;
+    }
+    case KEY_DC: {
+        if (*cursor < *length) {
+            move_TextField_gap(txt_field, *cursor);
+            erase_userText(txt_field, *cursor);
+        }
+        return true;
+    }
+    default: {
+        // Other curses keys have no char to insert
+        if (ch < 0 || ch > UCHAR_MAX) return true;
+    }
+    break;
+    }
+    if (*length >= txt_field->max_length) return false;
+    if (*length == 0) {
+        //Clear and rebox win on first char entered
+        wclear(win);
+        box(win, 0, 0);
+        count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_CLEAR);
+        count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_BOX);
+        // The box went over the verdict
+        if (txt_field->live_lint && txt_field->lint_handler != NULL) txt_field->lint_handler(txt_field, txt_field->lint_passing);
+    }
+    move_TextField_gap(txt_field, *cursor);
+    // Echo the character. The lint handler may have moved the cursor
+    mvwaddch(win, 1, *cursor + input_start_x, ch);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_PRINT);
+    // Add it to the buffer
+    buffer[(txt_field->gap_start)++] = ch;
+    (*cursor)++;
+    (*length)++;
+    txt_field->modified = true;
+    // Shift the rest of the text right on screen
+    if (*cursor < *length) draw_TextField_tail(txt_field, 0);
+    push_TextField_lint(txt_field, ch, (*cursor) -1);
+    return true;
+}
+
+/*
+ * Reads the characters after first that are already pending, up to TEXTFIELD_INPUT_BURST_MAX in total.
+ * The window is not touched meanwhile, so wgetch() doesn't refresh it on every call.
+ * Stops after the done key. Returns how many characters are in burst.
+ */
+static int get_userText_burst(WINDOW* win, int first, int done_key, int* burst)
+{
+    int res = 0;
+    burst[res++] = first;
+    if (first == done_key) return res;
+    wtimeout(win, 0);
+    int ch;
+    while (res < TEXTFIELD_INPUT_BURST_MAX && (ch = s4c_gui_read_key(win)) != ERR) {
+        burst[res++] = ch;
+        if (ch == done_key) break;
+    }
+    return res;
+}
+
+/*
+ * Clears the TextField and draws it, ready for step_TextField().
+ */
+void open_TextField(TextField txt_field)
+{
+    assert(txt_field!=NULL);
+    clear_TextField(txt_field);
+    WINDOW* win = take_TextField_win(txt_field);
+    // Deliver arrows, Home, End and Delete as single keys
+    keypad(win, TRUE);
+
+    draw_TextField(txt_field);
+    txt_field->damage = s4c_gui_damage;
+    // Move the cursor to the input field position
+    wmove(win, 1, 1);
+}
+
+/*
+ * Handles the input that is ready, waiting up to timeout milliseconds for the first key: 0 doesn't wait, -1 blocks.
+ * Typeahead, like a paste, is applied in bulk with a single refresh.
+ * Returns S4C_GUI_STEP_DONE once Enter is pressed, leaving any keys after it queued.
+ * Returns S4C_GUI_STEP_EOF when a blocking read fails because input is gone.
+ */
+S4C_Gui_Step step_TextField(TextField txt_field, int timeout)
+{
+    assert(txt_field!=NULL);
     WINDOW* win = txt_field->win;
+    // Only open TextFields take input
+    assert(win!=NULL);
+    s4c_gui_stepping++;
+
+    const int input_start_x = 1;
+    int burst[TEXTFIELD_INPUT_BURST_MAX];
+    S4C_Gui_Step res = S4C_GUI_STEP_CONTINUE;
+    bool got_input = false;
+    int ch;
+    while (res == S4C_GUI_STEP_CONTINUE && (ch = s4c_gui_wgetch(win, &timeout)) != ERR) {
+        if (ch == S4C_GUI_KEY_TIMER) {
+            if (txt_field->damage != s4c_gui_damage) {
+                // A notice over the window went away
+                touchwin(win);
+                s4c_gui_wrefresh(win, S4C_GUI_WIDGET_TEXTFIELD);
+                txt_field->damage = s4c_gui_damage;
+            }
+            continue;
+        }
+        got_input = true;
+        int burst_len = get_userText_burst(win, ch, '\n', burst);
+        // Keys are handled right away, even while a warning is shown
+        dismiss_TextField_warning(txt_field);
+        bool full = false;
+        bool resized = false;
+        for (int i = 0; i < burst_len; i++) {
+            if (burst[i] == '\n') {
+                res = S4C_GUI_STEP_DONE;
+                break;
+            }
+            if (burst[i] == KEY_RESIZE) {
+                resized = true;
+                continue;
+            }
+            if (!put_userText(txt_field, burst[i])) full = true;
+        }
+        if (resized) {
+            // Only the window geometry depends on the screen size: keep the buffer and lint state
+            uncover_s4c_gui_screen();
+            fit_s4c_gui_win(win, txt_field->height, txt_field->width, txt_field->start_y, txt_field->start_x);
+            redraw_TextField(txt_field);
+        }
+        wmove(win, 1, txt_field->cursor + input_start_x);
+        if (txt_field->damage != s4c_gui_damage) {
+            // A notice over the window went away
+            touchwin(win);
+            txt_field->damage = s4c_gui_damage;
+        }
+        s4c_gui_wrefresh(win, S4C_GUI_WIDGET_TEXTFIELD);
+        // Characters past max_length were discarded: warn once per burst
+        if (full && txt_field->handler != NULL) {
+            txt_field->handler(txt_field);
+        }
+        // Only handle what's already pending from now on
+        timeout = 0;
+    }
+    // A blocking read only fails when input is gone
+    if (!got_input && timeout < 0) res = S4C_GUI_STEP_EOF;
+    // The caller gets the screen back: don't leave the last keys unseen
+    if (res != S4C_GUI_STEP_CONTINUE) flush_s4c_gui_frame();
+    s4c_gui_stepping--;
+    return res;
+}
+
+/*
+ * Clears the TextField window from the screen, then releases it for the next TextField drawn.
+ */
+void close_TextField(TextField txt_field)
+{
+    assert(txt_field!=NULL);
+    cancel_s4c_gui_timer(txt_field->warn_timer);
+    txt_field->warn_timer = 0;
+    // Never drawn: nothing to clear
+    if (txt_field->win == NULL) return;
+    wclear(txt_field->win);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTFIELD, S4C_GUI_OP_CLEAR);
+    s4c_gui_wrefresh(txt_field->win, S4C_GUI_WIDGET_TEXTFIELD);
+    flush_s4c_gui_frame();
+    give_s4c_gui_win(txt_field->win);
+    txt_field->win = NULL;
+}
+
+void use_clean_TextField(TextField txt_field)
+{
+    assert(txt_field!=NULL);
+    open_TextField(txt_field);
+    while (step_TextField(txt_field, -1) == S4C_GUI_STEP_CONTINUE);
+    close_TextField(txt_field);
+}
+
+/*
+ * Span of text in one of the TextArea sources.
+ */
+typedef struct TextArea_Piece {
+    bool added; // In the add buffer, else in the original text
+    size_t start;
+    size_t len;
+    size_t newlines; // Newlines in the span
+    size_t offset; // Text before the piece, valid before index_from
+    size_t lines_before; // Newlines before the piece, valid before index_from
+} TextArea_Piece;
+
+/*
+ * Text pieces point into, with the offsets of its newlines in ascending order.
+ */
+typedef struct TextArea_Source {
+    const char* text;
+    size_t len;
+    size_t* newlines;
+    size_t num_newlines;
+    size_t newlines_capacity;
+} TextArea_Source;
+
+struct TextArea_s {
+    WINDOW* win;
+    int height;
+    int width;
+    int start_x;
+    int start_y;
+    TextArea_Source orig; // Borrowed from set_TextArea_text(), never copied
+    TextArea_Source add; // Typed text, only ever appended to
+    char* add_buffer; // Backs add.text
+    size_t add_capacity;
+    TextArea_Piece* pieces; // In text order, none empty
+    size_t num_pieces;
+    size_t pieces_capacity;
+    size_t index_from; // First piece whose offset and lines_before need a refresh, SIZE_MAX when none
+    size_t length;
+    size_t max_length;
+    size_t lines; // Newlines in the text
+    size_t cursor; // Offset of the insertion point
+    size_t goal_col; // Column kept by vertical moves
+    size_t top_line; // First line in view
+    size_t left_col; // First column in view
+    char* value; // Joined text for get_TextArea_value()
+    size_t value_capacity;
+    bool value_stale;
+    TextArea_Full_Handler* handler;
+    TextArea_Linter** linters;
+    size_t num_linters;
+    const void** linter_args;
+    char* prompt;
+    int warn_timer; // Timer clearing the warn_TextArea() message, 0 when none
+    unsigned damage; // Value of s4c_gui_damage when last drawn
+};
+
+/*
+ * Returns array grown to hold at least needed items of item_size, keeping the first used ones.
+ * Returns NULL on allocation failure, leaving array as it was.
+ */
+static void* grow_TextArea_array(void* array, size_t* capacity, size_t used, size_t needed, size_t item_size)
+{
+    if (needed <= *capacity) return array;
+    size_t new_capacity = (*capacity > 0 ? *capacity * 2 : 16);
+    while (new_capacity < needed) new_capacity *= 2;
+    void* res = s4c_gui_inner_calloc(new_capacity, item_size);
+    if (res == NULL) return NULL;
+    if (array != NULL) {
+        memcpy(res, array, used * item_size);
+        s4c_gui_inner_free(array);
+    }
+    *capacity = new_capacity;
+    return res;
+}
+
+static bool reserve_TextArea_pieces(TextArea area, size_t needed)
+{
+    TextArea_Piece* pieces = grow_TextArea_array(area->pieces, &(area->pieces_capacity), area->num_pieces, needed, sizeof(TextArea_Piece));
+    if (pieces == NULL) return false;
+    area->pieces = pieces;
+    return true;
+}
+
+static const TextArea_Source* get_TextArea_source(TextArea area, const TextArea_Piece* piece)
+{
+    return (piece->added ? &(area->add) : &(area->orig));
+}
+
+/*
+ * Returns how many newlines of the source are before pos.
+ */
+static size_t count_TextArea_newlines_before(const TextArea_Source* src, size_t pos)
+{
+    size_t lo = 0;
+    size_t hi = src->num_newlines;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (src->newlines[mid] < pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static size_t count_TextArea_newlines(const TextArea_Source* src, size_t start, size_t len)
+{
+    return count_TextArea_newlines_before(src, start + len) - count_TextArea_newlines_before(src, start);
+}
+
+/*
+ * Notes that the offset and lines_before of the pieces from i on changed. The ones before i stay indexed.
+ */
+static void stale_TextArea_index(TextArea area, size_t i)
+{
+    if (i < area->index_from) area->index_from = i;
+}
+
+/*
+ * Refreshes the offset and lines_before of the pieces from the first one an edit moved. Only runs when a lookup needs them.
+ */
+static void index_TextArea(TextArea area)
+{
+    size_t from = area->index_from;
+    if (from >= area->num_pieces) {
+        area->index_from = SIZE_MAX;
+        return;
+    }
+    size_t offset = 0;
+    size_t lines = 0;
+    if (from > 0) {
+        const TextArea_Piece* prev = &(area->pieces[from-1]);
+        offset = prev->offset + prev->len;
+        lines = prev->lines_before + prev->newlines;
+    }
+    for (size_t i = from; i < area->num_pieces; i++) {
+        area->pieces[i].offset = offset;
+        area->pieces[i].lines_before = lines;
+        offset += area->pieces[i].len;
+        lines += area->pieces[i].newlines;
+    }
+    area->index_from = SIZE_MAX;
+}
+
+/*
+ * Returns the index of the piece holding the char at offset, or num_pieces when offset is at the end.
+ */
+static size_t find_TextArea_piece(TextArea area, size_t offset)
+{
+    index_TextArea(area);
+    size_t lo = 0;
+    size_t hi = area->num_pieces;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (area->pieces[mid].offset + area->pieces[mid].len <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Returns the offset of the first char of the passed line, with two binary searches: over pieces, then over the source newlines.
+ */
+static size_t get_TextArea_line_start(TextArea area, size_t line)
+{
+    if (line == 0) return 0;
+    if (line > area->lines) return area->length;
+    index_TextArea(area);
+    // First piece holding the newline ending the previous line
+    size_t lo = 0;
+    size_t hi = area->num_pieces;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (area->pieces[mid].lines_before + area->pieces[mid].newlines < line) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    const TextArea_Piece* piece = &(area->pieces[lo]);
+    const TextArea_Source* src = get_TextArea_source(area, piece);
+    size_t newline = src->newlines[count_TextArea_newlines_before(src, piece->start) + (line - piece->lines_before - 1)];
+    return piece->offset + (newline - piece->start) + 1;
+}
+
+/*
+ * Returns the offset past the last char of the passed line, not counting its newline.
+ */
+static size_t get_TextArea_line_end(TextArea area, size_t line)
+{
+    return (line < area->lines ? get_TextArea_line_start(area, line + 1) - 1 : area->length);
+}
+
+static size_t get_TextArea_line_of(TextArea area, size_t offset)
+{
+    if (offset >= area->length) return area->lines;
+    size_t i = find_TextArea_piece(area, offset);
+    const TextArea_Piece* piece = &(area->pieces[i]);
+    return piece->lines_before + count_TextArea_newlines(get_TextArea_source(area, piece), piece->start, offset - piece->offset);
+}
+
+/*
+ * Appends ch to the add buffer. Returns false on allocation failure.
+ */
+static bool push_TextArea_add(TextArea area, char ch)
+{
+    TextArea_Source* add = &(area->add);
+    char* buffer = grow_TextArea_array(area->add_buffer, &(area->add_capacity), add->len, add->len + 1, sizeof(char));
+    if (buffer == NULL) return false;
+    area->add_buffer = buffer;
+    add->text = buffer;
+    if (ch == '\n') {
+        size_t* newlines = grow_TextArea_array(add->newlines, &(add->newlines_capacity), add->num_newlines, add->num_newlines + 1, sizeof(size_t));
+        if (newlines == NULL) return false;
+        add->newlines = newlines;
+        add->newlines[add->num_newlines++] = add->len;
+    }
+    buffer[add->len++] = ch;
+    return true;
+}
+
+/*
+ * Splits the piece at i after its first len chars, into pieces i and i+1. There must be room for one more piece.
+ */
+static void split_TextArea_piece(TextArea area, size_t i, size_t len)
+{
+    TextArea_Piece* piece = &(area->pieces[i]);
+    memmove(piece + 1, piece, (area->num_pieces - i) * sizeof(TextArea_Piece));
+    area->num_pieces++;
+    size_t head_newlines = count_TextArea_newlines(get_TextArea_source(area, piece), piece->start, len);
+    TextArea_Piece* tail = piece + 1;
+    tail->start = piece->start + len;
+    tail->len = piece->len - len;
+    tail->newlines = piece->newlines - head_newlines;
+    piece->len = len;
+    piece->newlines = head_newlines;
+}
+
+/*
+ * Inserts ch at the cursor and moves past it. The text is never moved: at most one piece is split.
+ * Returns false on allocation failure.
+ */
+static bool insert_TextArea_char(TextArea area, char ch)
+{
+    if (!reserve_TextArea_pieces(area, area->num_pieces + 2)) return false;
+    if (!push_TextArea_add(area, ch)) return false;
+    size_t add_pos = area->add.len - 1;
+    size_t newlines = (ch == '\n' ? 1 : 0);
+    size_t i = find_TextArea_piece(area, area->cursor);
+    bool at_piece_start = (i == area->num_pieces || area->pieces[i].offset == area->cursor);
+    TextArea_Piece* prev = (at_piece_start && i > 0 ? &(area->pieces[i-1]) : NULL);
+    if (prev != NULL && prev->added && prev->start + prev->len == add_pos) {
+        // Typing on: grow the last piece instead of adding one
+        prev->len++;
+        prev->newlines += newlines;
+    } else {
+        if (!at_piece_start) {
+            split_TextArea_piece(area, i, area->cursor - area->pieces[i].offset);
+            i++;
+        }
+        memmove(&(area->pieces[i+1]), &(area->pieces[i]), (area->num_pieces - i) * sizeof(TextArea_Piece));
+        area->num_pieces++;
+        area->pieces[i] = (TextArea_Piece) {
+            .added = true,
+            .start = add_pos,
+            .len = 1,
+            .newlines = newlines,
+        };
+    }
+    // Pieces before i kept their place
+    stale_TextArea_index(area, i);
+    area->value_stale = true;
+    area->length++;
+    area->lines += newlines;
+    area->cursor++;
+    return true;
+}
+
+/*
+ * Removes the char at pos, trimming or splitting its piece. Returns false on allocation failure.
+ */
+static bool delete_TextArea_char(TextArea area, size_t pos)
+{
+    if (!reserve_TextArea_pieces(area, area->num_pieces + 1)) return false;
+    size_t i = find_TextArea_piece(area, pos);
+    TextArea_Piece* piece = &(area->pieces[i]);
+    size_t o = pos - piece->offset;
+    size_t newlines = (get_TextArea_source(area, piece)->text[piece->start + o] == '\n' ? 1 : 0);
+    if (piece->len == 1) {
+        memmove(piece, piece + 1, (area->num_pieces - i - 1) * sizeof(TextArea_Piece));
+        area->num_pieces--;
+    } else if (o == 0) {
+        piece->start++;
+        piece->len--;
+        piece->newlines -= newlines;
+    } else if (o == piece->len - 1) {
+        piece->len--;
+        piece->newlines -= newlines;
+    } else {
+        split_TextArea_piece(area, i, o);
+        TextArea_Piece* tail = &(area->pieces[i+1]);
+        tail->start++;
+        tail->len--;
+        tail->newlines -= newlines;
+    }
+    stale_TextArea_index(area, i);
+    area->value_stale = true;
+    area->length--;
+    area->lines -= newlines;
+    if (area->cursor > pos) area->cursor--;
+    return true;
+}
+
+TextArea new_TextArea_(TextArea_Full_Handler* full_buffer_handler, TextArea_Linter** linters, size_t num_linters, const void** linter_args, size_t max_size, int height, int width, int start_x, int start_y, const char* prompt)
+{
+    assert(height>=0);
+    assert(width>=0);
+    assert(start_x>=0);
+    assert(start_y>=0);
+    TextArea res = s4c_gui_inner_calloc(1, sizeof(struct TextArea_s));
+    if (res == NULL) return NULL;
+    if (prompt != NULL) {
+        res->prompt = s4c_gui_inner_calloc(strlen(prompt)+1, sizeof(char));
+        if (res->prompt != NULL) memcpy(res->prompt, prompt, strlen(prompt));
+    }
+    if (linters != NULL && num_linters > 0) {
+        res->linters = s4c_gui_inner_calloc(num_linters, sizeof(TextArea_Linter*));
+        res->linter_args = s4c_gui_inner_calloc(num_linters, sizeof(void*));
+        if (res->linters != NULL && res->linter_args != NULL) {
+            res->num_linters = num_linters;
+            for (size_t i=0; i < num_linters; i++) {
+                res->linters[i] = linters[i];
+                res->linter_args[i] = (linter_args != NULL ? linter_args[i] : NULL);
+            }
+        }
+    }
+    res->height = height;
+    res->width = width;
+    res->start_x = start_x;
+    res->start_y = start_y;
+    res->win = newwin(height, width, start_y, start_x);
+    res->max_length = max_size;
+    res->handler = full_buffer_handler;
+    res->value_stale = true;
+    return res;
+}
+
+TextArea new_TextArea(size_t max_size, int height, int width, int start_x, int start_y)
+{
+    return new_TextArea_(&warn_TextArea, NULL, 0, NULL, max_size, height, width, start_x, start_y, NULL);
+}
+
+/*
+ * Replaces the TextArea content with text, which is not copied: it must stay valid and unchanged while the TextArea lives.
+ * Returns false when len is past the max size or on allocation failure.
+ */
+bool set_TextArea_text(TextArea area, const char* text, size_t len)
+{
+    assert(area!=NULL);
+    if (len > area->max_length || (text == NULL && len > 0)) return false;
+    if (!reserve_TextArea_pieces(area, 1)) return false;
+    size_t num_newlines = 0;
+    for (const char* nl = (len > 0 ? memchr(text, '\n', len) : NULL); nl != NULL; nl = memchr(nl + 1, '\n', len - (nl + 1 - text))) {
+        num_newlines++;
+    }
+    size_t* newlines = NULL;
+    if (num_newlines > 0) {
+        newlines = s4c_gui_inner_calloc(num_newlines, sizeof(size_t));
+        if (newlines == NULL) return false;
+        size_t n = 0;
+        for (const char* nl = memchr(text, '\n', len); nl != NULL; nl = memchr(nl + 1, '\n', len - (nl + 1 - text))) {
+            newlines[n++] = nl - text;
+        }
+    }
+    s4c_gui_inner_free(area->orig.newlines);
+    area->orig = (TextArea_Source) {
+        .text = text,
+        .len = len,
+        .newlines = newlines,
+        .num_newlines = num_newlines,
+    };
+    area->num_pieces = 0;
+    if (len > 0) {
+        area->pieces[area->num_pieces++] = (TextArea_Piece) {
+            .added = false,
+            .start = 0,
+            .len = len,
+            .newlines = num_newlines,
+        };
+    }
+    area->length = len;
+    area->lines = num_newlines;
+    area->cursor = 0;
+    area->goal_col = 0;
+    area->top_line = 0;
+    area->left_col = 0;
+    stale_TextArea_index(area, 0);
+    area->value_stale = true;
+    return true;
+}
+
+void free_TextArea(TextArea area)
+{
+    assert(area!=NULL);
+    cancel_s4c_gui_timer(area->warn_timer);
+    delwin(area->win);
+    s4c_gui_inner_free(area->orig.newlines);
+    s4c_gui_inner_free(area->add.newlines);
+    s4c_gui_inner_free(area->add_buffer);
+    s4c_gui_inner_free(area->pieces);
+    s4c_gui_inner_free(area->value);
+    s4c_gui_inner_free(area->linters);
+    s4c_gui_inner_free(area->linter_args);
+    s4c_gui_inner_free(area->prompt);
+    s4c_gui_inner_free(area);
+}
+
+/*
+ * Returns the text as a NUL-terminated string. The pieces are only joined here, and again after the next edit.
+ * Returns an empty string on allocation failure.
+ */
+const char* get_TextArea_value(TextArea area)
+{
+    assert(area!=NULL);
+    if (!area->value_stale) return area->value;
+    if (area->value_capacity < area->length + 1) {
+        char* value = s4c_gui_inner_calloc(area->length + 1, sizeof(char));
+        if (value == NULL) return "";
+        s4c_gui_inner_free(area->value);
+        area->value = value;
+        area->value_capacity = area->length + 1;
+    }
+    size_t len = 0;
+    for (size_t i = 0; i < area->num_pieces; i++) {
+        const TextArea_Piece* piece = &(area->pieces[i]);
+        memcpy(area->value + len, get_TextArea_source(area, piece)->text + piece->start, piece->len);
+        len += piece->len;
+    }
+    area->value[len] = '\0';
+    area->value_stale = false;
+    return area->value;
+}
+
+size_t get_TextArea_len(TextArea area)
+{
+    assert(area!=NULL);
+    return area->length;
+}
+
+/*
+ * Returns how many lines the text has, counting the one after the last newline.
+ */
+size_t get_TextArea_lines(TextArea area)
+{
+    assert(area!=NULL);
+    return area->lines + 1;
+}
+
+WINDOW* get_TextArea_win(TextArea area)
+{
+    assert(area!=NULL);
+    return area->win;
+}
+
+bool lint_TextArea(TextArea area)
+{
+    assert(area!=NULL);
+    bool res = true;
+    for (size_t i=0; res == true && i < area->num_linters; i++) {
+        if (area->linters[i] != NULL) {
+            // NULL func being found don't affect the result
+            res = area->linters[i](area, area->linter_args[i]);
+        }
+    }
+    return res;
+}
+
+bool lint_TextArea_not_empty(TextArea area, const void* unused)
+{
+    (void) unused;
+    if (area==NULL) return false;
+    return area->length>0;
+}
+
+/*
+ * Passes when every char is in the TextField_CharClass passed as arg. Pieces are scanned where they are, without joining the text.
+ */
+bool lint_TextArea_charclass(TextArea area, const void* charclass)
+{
+    if (area==NULL || charclass == NULL) return false;
+    for (size_t i = 0; i < area->num_pieces; i++) {
+        const TextArea_Piece* piece = &(area->pieces[i]);
+        const char* text = get_TextArea_source(area, piece)->text + piece->start;
+        if (scan_TextField_CharClass((const TextField_CharClass*) charclass, text, piece->len) != piece->len) return false;
+    }
+    return true;
+}
+
+/*
+ * Passes when the TextArea length is within the TextField_Length_Range passed as arg.
+ */
+bool lint_TextArea_length_range(TextArea area, const void* range)
+{
+    if (area==NULL || range == NULL) return false;
+    const TextField_Length_Range* r = (const TextField_Length_Range*) range;
+    return (area->length >= r->min && area->length <= r->max);
+}
+
+/*
+ * Draws the line shown at row of the viewport, clipped to the window width. Tabs and other control chars show as spaces.
+ */
+static void draw_TextArea_row(TextArea area, int row)
+{
+    WINDOW* win = area->win;
+    int cols = getmaxx(win) - 2;
+    size_t line = area->top_line + row;
+    int col = 0;
+    wmove(win, row + 1, 1);
+    if (line <= area->lines) {
+        size_t start = get_TextArea_line_start(area, line);
+        size_t skipped = 0;
+        bool eol = false;
+        for (size_t i = find_TextArea_piece(area, start); !eol && col < cols && i < area->num_pieces; i++) {
+            const TextArea_Piece* piece = &(area->pieces[i]);
+            const char* text = get_TextArea_source(area, piece)->text + piece->start;
+            for (size_t j = (start > piece->offset ? start - piece->offset : 0); j < piece->len && col < cols; j++) {
+                unsigned char ch = text[j];
+                if (ch == '\n') {
+                    eol = true;
+                    break;
+                }
+                if (skipped < area->left_col) {
+                    skipped++;
+                    continue;
+                }
+                waddch(win, ((ch < ' ' || ch == 127) ? ' ' : ch));
+                col++;
+            }
+        }
+    }
+    for (; col < cols; col++) {
+        waddch(win, ' ');
+    }
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTAREA, S4C_GUI_OP_PRINT);
+}
+
+/*
+ * Draws the lines from first to last that are in view.
+ */
+static void draw_TextArea_rows(TextArea area, size_t first, size_t last)
+{
+    // The window may have been shrunk to fit a resized screen
+    int rows = getmaxy(area->win) - 2;
+    int cols = getmaxx(area->win) - 2;
+    if (rows <= 0 || cols <= 0) return;
+    if (first < area->top_line) first = area->top_line;
+    for (size_t line = first; line <= last && line < area->top_line + rows; line++) {
+        draw_TextArea_row(area, line - area->top_line);
+    }
+    if (area->length == 0 && area->prompt != NULL) {
+        mvwaddnstr(area->win, 1, 1, area->prompt, cols);
+        count_s4c_gui_op(S4C_GUI_WIDGET_TEXTAREA, S4C_GUI_OP_PRINT);
+    }
+}
+
+/*
+ * Scrolls the viewport so that the cursor is in it. Returns true when it moved.
+ */
+static bool scroll_TextArea(TextArea area)
+{
+    int height = getmaxy(area->win);
+    int width = getmaxx(area->win);
+    size_t rows = (height > 2 ? height - 2 : 1);
+    size_t cols = (width > 2 ? width - 2 : 1);
+    size_t line = get_TextArea_line_of(area, area->cursor);
+    size_t col = area->cursor - get_TextArea_line_start(area, line);
+    size_t top_line = area->top_line;
+    size_t left_col = area->left_col;
+    if (line < area->top_line) {
+        area->top_line = line;
+    } else if (line >= area->top_line + rows) {
+        area->top_line = line - rows + 1;
+    }
+    if (col < area->left_col) {
+        area->left_col = col;
+    } else if (col >= area->left_col + cols) {
+        area->left_col = col - cols + 1;
+    }
+    return (top_line != area->top_line || left_col != area->left_col);
+}
+
+static void move_TextArea_cursor(TextArea area)
+{
+    size_t line = get_TextArea_line_of(area, area->cursor);
+    size_t col = area->cursor - get_TextArea_line_start(area, line);
+    wmove(area->win, line - area->top_line + 1, col - area->left_col + 1);
+}
+
+/*
+ * Redraws the TextArea window: box, rows in view or prompt, and cursor. Doesn't refresh.
+ */
+static void redraw_TextArea(TextArea area)
+{
+    werase(area->win);
+    box(area->win, 0, 0);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTAREA, S4C_GUI_OP_CLEAR);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTAREA, S4C_GUI_OP_BOX);
+    scroll_TextArea(area);
+    draw_TextArea_rows(area, area->top_line, area->lines);
+    move_TextArea_cursor(area);
+}
+
+void draw_TextArea(TextArea area)
+{
+    assert(area!=NULL);
+    redraw_TextArea(area);
+    s4c_gui_wrefresh(area->win, S4C_GUI_WIDGET_TEXTAREA);
+}
+
+static void expire_TextArea_warning(void* arg)
+{
+    TextArea area = arg;
+    area->warn_timer = 0;
+    redraw_TextArea(area);
+    s4c_gui_wrefresh(area->win, S4C_GUI_WIDGET_TEXTAREA);
+}
+
+/*
+ * Removes the warn_TextArea() message before its deadline, without refreshing.
+ */
+static void dismiss_TextArea_warning(TextArea area)
+{
+    if (area->warn_timer == 0) return;
+    cancel_s4c_gui_timer(area->warn_timer);
+    area->warn_timer = 0;
+    redraw_TextArea(area);
+}
+
+/*
+ * Default full buffer handler: shows a warning for TEXTFIELD_WARN_MSECS, then the text again.
+ * Doesn't block: the next key press removes the warning right away.
+ */
+void warn_TextArea(TextArea area)
+{
+    assert(area!=NULL);
+    WINDOW* win = area->win;
+    werase(win);
+    box(win,0,0);
+    mvwprintw(win, 1, 1, "%s", "Input is full.");
+    mvwprintw(win, 2, 1, "%s", "Press Backspace or Ctrl-D.");
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTAREA, S4C_GUI_OP_CLEAR);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTAREA, S4C_GUI_OP_BOX);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTAREA, S4C_GUI_OP_PRINT);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTAREA, S4C_GUI_OP_PRINT);
+    s4c_gui_wrefresh(win, S4C_GUI_WIDGET_TEXTAREA);
+    cancel_s4c_gui_timer(area->warn_timer);
+    area->warn_timer = add_s4c_gui_timer(TEXTFIELD_WARN_MSECS, &expire_TextArea_warning, area);
+    // No timer slot left: don't leave the warning up
+    if (area->warn_timer == 0) expire_TextArea_warning(area);
+}
+
+/*
+ * Applies one input key to the TextArea text and cursor, without drawing.
+ * Returns false when a char was dropped because the text is full.
+ */
+static bool put_TextArea_key(TextArea area, int ch)
+{
+    size_t line = get_TextArea_line_of(area, area->cursor);
+    int height = getmaxy(area->win);
+    size_t rows = (height > 2 ? height - 2 : 1);
+    size_t target = line;
+    bool res = true;
+    switch (ch) {
+    case KEY_LEFT: {
+        if (area->cursor > 0) area->cursor--;
+    }
+    break;
+    case KEY_RIGHT: {
+        if (area->cursor < area->length) area->cursor++;
+    }
+    break;
+    case KEY_HOME: {
+        area->cursor = get_TextArea_line_start(area, line);
+    }
+    break;
+    case KEY_END: {
+        area->cursor = get_TextArea_line_end(area, line);
+    }
+    break;
+    case KEY_UP:
+    case KEY_DOWN:
+    case KEY_PPAGE:
+    case KEY_NPAGE: {
+        if (ch == KEY_UP) {
+            target = (line > 0 ? line - 1 : 0);
+        } else if (ch == KEY_DOWN) {
+            target = (line < area->lines ? line + 1 : line);
+        } else if (ch == KEY_PPAGE) {
+            target = (line > rows ? line - rows : 0);
+        } else {
+            target = (line + rows < area->lines ? line + rows : area->lines);
+        }
+        size_t start = get_TextArea_line_start(area, target);
+        size_t len = get_TextArea_line_end(area, target) - start;
+        // Vertical moves keep aiming for the column the cursor was last put in
+        area->cursor = start + (area->goal_col < len ? area->goal_col : len);
+        return true;
+    }
+    case KEY_BACKSPACE:
+    case '\b':
+    case 127: {
+        if (area->cursor > 0) delete_TextArea_char(area, area->cursor - 1);
+    }
+    break;
+    case KEY_DC: {
+        if (area->cursor < area->length) delete_TextArea_char(area, area->cursor);
+    }
+    break;
+    default: {
+        // Other curses keys have no char to insert
+        if (ch < 0 || ch > UCHAR_MAX) return true;
+        res = (area->length < area->max_length && insert_TextArea_char(area, ch));
+    }
+    break;
+    }
+    area->goal_col = area->cursor - get_TextArea_line_start(area, get_TextArea_line_of(area, area->cursor));
+    return res;
+}
+
+/*
+ * Draws the TextArea, keeping its text, ready for step_TextArea().
+ */
+void open_TextArea(TextArea area)
+{
+    assert(area!=NULL);
+    // Deliver arrows, Home, End, page keys and Delete as single keys
+    keypad(area->win, TRUE);
+    draw_TextArea(area);
+    area->damage = s4c_gui_damage;
+}
+
+/*
+ * Handles the input that is ready, waiting up to timeout milliseconds for the first key: 0 doesn't wait, -1 blocks.
+ * Typeahead, like a paste, is applied in bulk with a single refresh, redrawing only the rows it changed.
+ * Returns S4C_GUI_STEP_DONE once TEXTAREA_DONE_KEY is pressed, leaving any keys after it queued.
+ * Returns S4C_GUI_STEP_EOF when a blocking read fails because input is gone.
+ */
+S4C_Gui_Step step_TextArea(TextArea area, int timeout)
+{
+    assert(area!=NULL);
+    WINDOW* win = area->win;
     assert(win!=NULL);
+    s4c_gui_stepping++;
+
+    int burst[TEXTFIELD_INPUT_BURST_MAX];
+    S4C_Gui_Step res = S4C_GUI_STEP_CONTINUE;
+    bool got_input = false;
+    int ch;
+    while (res == S4C_GUI_STEP_CONTINUE && (ch = s4c_gui_wgetch(win, &timeout)) != ERR) {
+        if (ch == S4C_GUI_KEY_TIMER) {
+            if (area->damage != s4c_gui_damage) {
+                // A notice over the window went away
+                touchwin(win);
+                s4c_gui_wrefresh(win, S4C_GUI_WIDGET_TEXTAREA);
+                area->damage = s4c_gui_damage;
+            }
+            continue;
+        }
+        got_input = true;
+        int burst_len = get_userText_burst(win, ch, TEXTAREA_DONE_KEY, burst);
+        // Keys are handled right away, even while a warning is shown
+        dismiss_TextArea_warning(area);
+        bool full = false;
+        size_t lines = area->lines;
+        size_t dirty_first = SIZE_MAX;
+        size_t dirty_last = 0;
+        bool resized = false;
+        for (int i = 0; i < burst_len; i++) {
+            if (burst[i] == TEXTAREA_DONE_KEY) {
+                res = S4C_GUI_STEP_DONE;
+                break;
+            }
+            if (burst[i] == KEY_RESIZE) {
+                resized = true;
+                continue;
+            }
+            size_t length = area->length;
+            size_t line = get_TextArea_line_of(area, area->cursor);
+            if (!put_TextArea_key(area, burst[i])) full = true;
+            if (area->length != length) {
+                // Backspace at a line start joins it to the one above
+                size_t after = get_TextArea_line_of(area, area->cursor);
+                if (after < line) line = after;
+                if (line < dirty_first) dirty_first = line;
+                if (line > dirty_last) dirty_last = line;
+            }
+        }
+        if (resized) {
+            // Only the viewport depends on the screen size: keep the pieces and line index
+            uncover_s4c_gui_screen();
+            fit_s4c_gui_win(win, area->height, area->width, area->start_y, area->start_x);
+            redraw_TextArea(area);
+        } else if (scroll_TextArea(area)) {
+            draw_TextArea_rows(area, area->top_line, SIZE_MAX);
+        } else if (dirty_first != SIZE_MAX) {
+            // Rows below an added or removed line all shift
+            draw_TextArea_rows(area, dirty_first, (area->lines != lines ? SIZE_MAX : dirty_last));
+        }
+        move_TextArea_cursor(area);
+        if (area->damage != s4c_gui_damage) {
+            // A notice over the window went away
+            touchwin(win);
+            area->damage = s4c_gui_damage;
+        }
+        s4c_gui_wrefresh(win, S4C_GUI_WIDGET_TEXTAREA);
+        // Characters past max_length were discarded: warn once per burst
+        if (full && area->handler != NULL) {
+            area->handler(area);
+        }
+        // Only handle what's already pending from now on
+        timeout = 0;
+    }
+    // A blocking read only fails when input is gone
+    if (!got_input && timeout < 0) res = S4C_GUI_STEP_EOF;
+    // The caller gets the screen back: don't leave the last keys unseen
+    if (res != S4C_GUI_STEP_CONTINUE) flush_s4c_gui_frame();
+    s4c_gui_stepping--;
+    return res;
+}
+
+/*
+ * Clears the TextArea window from the screen.
+ */
+void close_TextArea(TextArea area)
+{
+    assert(area!=NULL);
+    cancel_s4c_gui_timer(area->warn_timer);
+    area->warn_timer = 0;
+    wclear(area->win);
+    count_s4c_gui_op(S4C_GUI_WIDGET_TEXTAREA, S4C_GUI_OP_CLEAR);
+    s4c_gui_wrefresh(area->win, S4C_GUI_WIDGET_TEXTAREA);
+    flush_s4c_gui_frame();
+}
+
+void use_clean_TextArea(TextArea area)
+{
+    assert(area!=NULL);
+    open_TextArea(area);
+    while (step_TextArea(area, -1) == S4C_GUI_STEP_CONTINUE);
+    close_TextArea(area);
+}
+// }
+// TEXT_FIELD_H_
+
+
+#ifndef TOGGLE_H_
+#error "This should not happen. TOGGLE_H_ is defined in s4c_gui.h"
+#include "toggle.h"
+#endif // TOGGLE_H_
+
+static const int TOGGLE_MENU_DEFAULT_QUIT_KEY = KEY_F(1);
+
+static void cycle_toggle_state(Toggle *toggle)
+{
+    toggle->state.ts_state.current_state = (toggle->state.ts_state.current_state + 1) % toggle->state.ts_state.num_states;
+}
+
+static ToggleMenu_DirtySet* new_ToggleMenu_DirtySet(bool all)
+{
+    ToggleMenu_DirtySet* res = s4c_gui_inner_calloc(1, sizeof(ToggleMenu_DirtySet));
+    if (res == NULL) return NULL;
+    res->all = all;
+    return res;
+}
+
+/*
+ * Adds the toggle to the set, which turns into one holding every toggle when it overflows.
+ */
+static void add_ToggleMenu_DirtySet(ToggleMenu_DirtySet* dirty, int toggle_index)
+{
+    if (dirty == NULL || dirty->all) return;
+    for (int i = 0; i < dirty->count; i++) {
+        if (dirty->toggles[i] == toggle_index) return;
+    }
+    if (dirty->count == TOGGLEMENU_DIRTY_MAX) {
+        dirty->all = true;
+        return;
+    }
+    dirty->toggles[dirty->count++] = toggle_index;
+}
+
+static void free_ToggleMenu_DirtySet(ToggleMenu_DirtySet* dirty)
+{
+    if (dirty == NULL) return;
+    s4c_gui_inner_free(dirty);
+}
+
+typedef struct ToggleMenu_SearchKey {
+    const char* text; // Label from the start of a word on
+    int toggle;
+} ToggleMenu_SearchKey;
+
+struct ToggleMenu_SearchIndex_s {
+    ToggleMenu_SearchKey* keys; // Sorted by text ignoring case, then by toggle
+    int count;
+    char* labels; // Copy of every label, each ended by '\0'
+    int num_toggles;
+    uint64_t* toggle_bits; // Wavelet matrix of the keys' toggles: a row of count bits per level, high bit first
+    int* toggle_ranks; // Set bits before each word of a row
+    int* toggle_zeros; // Clear bits in each row
+    int toggle_levels;
+    int toggle_words; // Words in a row
+    bool built; // Filled on the first search
+};
+
+/*
+ * Compares up to n chars of a and b, ignoring case.
+ */
+static int compare_ToggleMenu_search_text(const char* a, const char* b, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        int ca = tolower((unsigned char)a[i]);
+        int cb = tolower((unsigned char)b[i]);
+        if (ca != cb) return ca - cb;
+        if (ca == '\0') return 0;
+    }
+    return 0;
+}
+
+static int compare_ToggleMenu_search_keys(const void* a, const void* b)
+{
+    const ToggleMenu_SearchKey* ka = a;
+    const ToggleMenu_SearchKey* kb = b;
+    int res = compare_ToggleMenu_search_text(ka->text, kb->text, SIZE_MAX);
+    return (res != 0 ? res : ka->toggle - kb->toggle);
+}
+
+static bool is_ToggleMenu_word_start(const char* label, size_t i)
+{
+    return (isalnum((unsigned char)label[i]) && (i == 0 || !isalnum((unsigned char)label[i-1])));
+}
+
+/*
+ * Frees what the index holds, leaving it empty.
+ */
+static void clear_ToggleMenu_SearchIndex(ToggleMenu_SearchIndex search)
+{
+    s4c_gui_inner_free(search->keys);
+    s4c_gui_inner_free(search->labels);
+    s4c_gui_inner_free(search->toggle_bits);
+    s4c_gui_inner_free(search->toggle_ranks);
+    s4c_gui_inner_free(search->toggle_zeros);
+    *search = (struct ToggleMenu_SearchIndex_s) {0};
+}
+
+/*
+ * Builds the wavelet matrix of the sorted keys' toggles, so that pick_ToggleMenu_search_match() can find the first
+ * toggle from a given one on in a range of keys without scanning it. Returns false on allocation failure.
+ */
+static bool index_ToggleMenu_search_toggles(ToggleMenu_SearchIndex search)
+{
+    int levels = 1;
+    while (levels < 31 && ((search->num_toggles - 1) >> levels) != 0) levels++;
+    int words = search->count / 64 + 1;
+    search->toggle_levels = levels;
+    search->toggle_words = words;
+    search->toggle_bits = s4c_gui_inner_calloc(levels * words, sizeof(uint64_t));
+    search->toggle_ranks = s4c_gui_inner_calloc(levels * words, sizeof(int));
+    search->toggle_zeros = s4c_gui_inner_calloc(levels, sizeof(int));
+    int* cur = s4c_gui_inner_calloc(search->count + 1, sizeof(int));
+    int* next = s4c_gui_inner_calloc(search->count + 1, sizeof(int));
+    bool res = (search->toggle_bits != NULL && search->toggle_ranks != NULL && search->toggle_zeros != NULL && cur != NULL && next != NULL);
+    for (int i = 0; res && i < search->count; i++) {
+        cur[i] = search->keys[i].toggle;
+    }
+    for (int level = 0; res && level < levels; level++) {
+        int bit = levels - 1 - level;
+        uint64_t* row = search->toggle_bits + (size_t)level * words;
+        int* ranks = search->toggle_ranks + (size_t)level * words;
+        // Stable split: toggles with the bit clear go first in the next row
+        int zeros = 0;
+        for (int i = 0; i < search->count; i++) {
+            if ((cur[i] >> bit) & 1) {
+                row[i / 64] |= (uint64_t)1 << (i % 64);
+            } else {
+                next[zeros++] = cur[i];
+            }
+        }
+        int ones = zeros;
+        for (int i = 0; i < search->count; i++) {
+            if ((cur[i] >> bit) & 1) next[ones++] = cur[i];
+        }
+        search->toggle_zeros[level] = zeros;
+        int ranked = 0;
+        for (int w = 0; w < words; w++) {
+            ranks[w] = ranked;
+            ranked += __builtin_popcountll(row[w]);
+        }
+        int* swap = cur;
+        cur = next;
+        next = swap;
+    }
+    s4c_gui_inner_free(cur);
+    s4c_gui_inner_free(next);
+    return res;
+}
+
+/*
+ * Fills an empty index with every word start in the labels, copying them. Returns false on allocation failure.
+ */
+static bool fill_ToggleMenu_SearchIndex(ToggleMenu_SearchIndex search, const Toggle* toggles, int num_toggles)
+{
+    size_t size = 0;
+    int count = 0;
+    for (int i = 0; i < num_toggles; i++) {
+        const char* label = toggles[i].label;
+        if (label == NULL) continue;
+        size_t j = 0;
+        for (; label[j] != '\0'; j++) {
+            if (is_ToggleMenu_word_start(label, j)) count++;
+        }
+        size += j + 1;
+    }
+    search->num_toggles = num_toggles;
+    search->labels = s4c_gui_inner_calloc(size + 1, sizeof(char));
+    search->keys = s4c_gui_inner_calloc(count + 1, sizeof(ToggleMenu_SearchKey));
+    if (search->labels == NULL || search->keys == NULL) return false;
+    size_t at = 0;
+    for (int i = 0; i < num_toggles; i++) {
+        if (toggles[i].label == NULL) continue;
+        const char* label = search->labels + at;
+        size_t len = strlen(toggles[i].label);
+        memcpy(search->labels + at, toggles[i].label, len + 1);
+        at += len + 1;
+        for (size_t j = 0; label[j] != '\0'; j++) {
+            if (!is_ToggleMenu_word_start(label, j)) continue;
+            search->keys[search->count++] = (ToggleMenu_SearchKey) {
+                .text = label + j,
+                .toggle = i,
+            };
+        }
+    }
+    if (search->count > 1) qsort(search->keys, search->count, sizeof(ToggleMenu_SearchKey), &compare_ToggleMenu_search_keys);
+    search->built = index_ToggleMenu_search_toggles(search);
+    return search->built;
+}
+
+/*
+ * Returns an empty index, filled on the first search so menus nobody searches don't pay for it. NULL on allocation failure.
+ */
+static ToggleMenu_SearchIndex new_ToggleMenu_SearchIndex(void)
+{
+    return s4c_gui_inner_calloc(1, sizeof(struct ToggleMenu_SearchIndex_s));
+}
+
+/*
+ * Returns the index of the menu, filling it with every word start in the labels when it's still empty.
+ * The labels are copied, so it stays valid when the caller replaces or frees them; clear it to pick the change up.
+ * Returns NULL on allocation failure, leaving it empty for the next try.
+ */
+static ToggleMenu_SearchIndex use_ToggleMenu_SearchIndex(ToggleMenu toggle_menu)
+{
+    ToggleMenu_SearchIndex search = toggle_menu.search;
+    if (search == NULL || search->built) return search;
+    if (!fill_ToggleMenu_SearchIndex(search, toggle_menu.toggles, toggle_menu.num_toggles)) {
+        clear_ToggleMenu_SearchIndex(search);
+        return NULL;
+    }
+    return search;
+}
+
+
+struct ToggleMenu_Layout_s {
+    int* label_widths; // One per measured toggle, up to TOGGLEMENU_COLUMN_MAX
+    int* value_widths; // One per measured toggle, as drawn by format_ToggleMenu_value(), up to TOGGLEMENU_COLUMN_MAX
+    int first; // First measured toggle
+    int count; // Measured toggles: all of them, or the rows in view of a virtualized menu
+    int capacity; // Room in the width arrays
+    int label_max; // Widest label
+    int value_max;
+    int label_counts[TOGGLEMENU_COLUMN_MAX+1]; // Labels of each width
+    int value_counts[TOGGLEMENU_COLUMN_MAX+1];
+};
+
+/*
+ * Returns the state of the toggle as shown in the state window, formatted into buf when needed, and sets width to its length.
+ */
+static const char* format_ToggleMenu_value(const Toggle* toggle, char* buf, size_t size, int* width)
+{
+    const char* res = buf;
+    buf[0] = '\0';
+    if (toggle->type == BOOL_TOGGLE) {
+        snprintf(buf, size, "[%s]", toggle->state.bool_state ? "ON" : "OFF");
+    } else if (toggle->type == MULTI_STATE_TOGGLE) {
+        if (toggle->multistate_formatter != NULL) {
+            snprintf(buf, size, "[%s]", toggle->multistate_formatter(toggle->state.ts_state.current_state));
+        } else {
+            snprintf(buf, size, "[%d/%d]", toggle->state.ts_state.current_state, toggle->state.ts_state.num_states);
+        }
+    } else if (toggle->type == TEXTFIELD_TOGGLE) {
+        res = get_TextField_value(toggle->state.txt_state);
+        *width = get_TextField_len(toggle->state.txt_state);
+        return res;
+    }
+    *width = strlen(buf);
+    return res;
+}
+
+/*
+ * Stores the width of entry i of a column, cut to TOGGLEMENU_COLUMN_MAX, keeping the count of entries of each width.
+ * When the last widest entry shrinks the next max is found in the counts, without looking at the other entries.
+ * Returns true when the max changed.
+ */
+static bool set_ToggleMenu_column_width(int* widths, int* counts, int i, int width, int* max)
+{
+    if (width > TOGGLEMENU_COLUMN_MAX) width = TOGGLEMENU_COLUMN_MAX;
+    int old = widths[i];
+    if (old == width) return false;
+    widths[i] = width;
+    counts[old]--;
+    counts[width]++;
+    if (width > *max) {
+        *max = width;
+        return true;
+    }
+    if (old != *max || counts[old] > 0) return false;
+    while (*max > 0 && counts[*max] == 0) (*max)--;
+    return true;
+}
+
+/*
+ * Measures the label and value of toggle i again, when it's among the measured ones.
+ * Returns true when a column changed width, moving the ones after it.
+ */
+static bool measure_ToggleMenu_Layout(ToggleMenu_Layout layout, const Toggle* toggles, int i)
+{
+    int at = i - layout->first;
+    if (at < 0 || at >= layout->count) return false;
+    char buf[TOGGLEMENU_VALUE_MAX];
+    int value_width = 0;
+    format_ToggleMenu_value(&(toggles[i]), buf, sizeof(buf), &value_width);
+    int label_width = (toggles[i].label != NULL ? strlen(toggles[i].label) : 0);
+    bool res = set_ToggleMenu_column_width(layout->label_widths, layout->label_counts, at, label_width, &(layout->label_max));
+    res = set_ToggleMenu_column_width(layout->value_widths, layout->value_counts, at, value_width, &(layout->value_max)) || res;
+    return res;
+}
+
+/*
+ * Measures the count toggles from first on, forgetting the ones measured before.
+ * Keeps the old ones when there's no room for them and it can't be allocated.
+ */
+static void measure_ToggleMenu_Layout_rows(ToggleMenu_Layout layout, const Toggle* toggles, int first, int count)
+{
+    if (count > layout->capacity) {
+        int* label_widths = s4c_gui_inner_calloc(count, sizeof(int));
+        int* value_widths = s4c_gui_inner_calloc(count, sizeof(int));
+        if (label_widths == NULL || value_widths == NULL) {
+            s4c_gui_inner_free(label_widths);
+            s4c_gui_inner_free(value_widths);
+            return;
+        }
+        s4c_gui_inner_free(layout->label_widths);
+        s4c_gui_inner_free(layout->value_widths);
+        layout->label_widths = label_widths;
+        layout->value_widths = value_widths;
+        layout->capacity = count;
+    }
+    layout->first = first;
+    layout->count = count;
+    // Every width starts at 0
+    if (count > 0) {
+        memset(layout->label_widths, 0, count * sizeof(int));
+        memset(layout->value_widths, 0, count * sizeof(int));
+    }
+    memset(layout->label_counts, 0, sizeof(layout->label_counts));
+    memset(layout->value_counts, 0, sizeof(layout->value_counts));
+    layout->label_counts[0] = count;
+    layout->value_counts[0] = count;
+    layout->label_max = 0;
+    layout->value_max = 0;
+    for (int i = first; i < first + count; i++) {
+        measure_ToggleMenu_Layout(layout, toggles, i);
+    }
+}
+
+/*
+ * Measures the label and value of the first count toggles. Returns NULL on allocation failure.
+ */
+static ToggleMenu_Layout new_ToggleMenu_Layout(const Toggle* toggles, int count)
+{
+    ToggleMenu_Layout res = s4c_gui_inner_calloc(1, sizeof(struct ToggleMenu_Layout_s));
+    if (res == NULL) return NULL;
+    measure_ToggleMenu_Layout_rows(res, toggles, 0, count);
+    if (res->count != count) {
+        s4c_gui_inner_free(res);
+        return NULL;
+    }
+    return res;
+}
+
+static void free_ToggleMenu_Layout(ToggleMenu_Layout layout)
+{
+    if (layout == NULL) return;
+    s4c_gui_inner_free(layout->label_widths);
+    s4c_gui_inner_free(layout->value_widths);
+    s4c_gui_inner_free(layout);
+}
+
+typedef struct ToggleMenu_Listener {
+    ToggleMenu_Change_Handler* handler; // NULL once removed during a delivery
+    void* arg;
+} ToggleMenu_Listener;
+
+struct ToggleMenu_Changes_s {
+    uint64_t* pending; // Changed since the last batch. NULL until the first listener is added
+    uint64_t* batch; // Being delivered, all clear otherwise
+    int num_words;
+    int num_toggles;
+    int count; // Bits set in pending
+    ToggleMenu_Listener* listeners;
+    int num_listeners;
+    int listeners_capacity;
+    bool delivering;
+};
+
+/*
+ * Returns changes without bitsets: nothing is recorded until a listener is added. NULL on allocation failure.
+ */
+static ToggleMenu_Changes new_ToggleMenu_Changes(int num_toggles)
+{
+    ToggleMenu_Changes res = s4c_gui_inner_calloc(1, sizeof(struct ToggleMenu_Changes_s));
+    if (res == NULL) return NULL;
+    res->num_toggles = num_toggles;
+    res->num_words = (num_toggles + 63) / 64;
+    return res;
+}
+
+/*
+ * Allocates the bitsets when they aren't yet. Returns false on allocation failure.
+ */
+static bool alloc_ToggleMenu_Changes(ToggleMenu_Changes changes)
+{
+    if (changes->pending != NULL) return true;
+    // Both bitsets share one allocation, never empty
+    changes->pending = s4c_gui_inner_calloc(2 * changes->num_words + 1, sizeof(uint64_t));
+    if (changes->pending == NULL) return false;
+    changes->batch = changes->pending + changes->num_words;
+    return true;
+}
+
+static void free_ToggleMenu_Changes(ToggleMenu_Changes changes)
+{
+    if (changes == NULL) return;
+    // pending may have been swapped with batch
+    if (changes->pending != NULL) s4c_gui_inner_free(changes->pending < changes->batch ? changes->pending : changes->batch);
+    s4c_gui_inner_free(changes->listeners);
+    s4c_gui_inner_free(changes);
+}
+
+static void record_ToggleMenu_change(ToggleMenu_Changes changes, int toggle_index)
+{
+    // Nobody listens yet
+    if (changes->pending == NULL) return;
+    uint64_t bit = (uint64_t) 1 << (toggle_index % 64);
+    uint64_t* word = &(changes->pending[toggle_index / 64]);
+    if (*word & bit) return;
+    *word |= bit;
+    changes->count++;
+}
+
+/*
+ * Adds a listener getting the toggles changed by each input event as one batch, and the ones left when the menu is closed.
+ * Changes are only recorded from the first listener on. Returns false when it couldn't be stored.
+ */
+bool add_ToggleMenu_listener(ToggleMenu toggle_menu, ToggleMenu_Change_Handler* handler, void* arg)
+{
+    assert(handler!=NULL);
+    ToggleMenu_Changes changes = toggle_menu.changes;
+    if (changes == NULL || !alloc_ToggleMenu_Changes(changes)) return false;
+    if (changes->num_listeners == changes->listeners_capacity) {
+        int capacity = (changes->listeners_capacity > 0 ? changes->listeners_capacity * 2 : 4);
+        ToggleMenu_Listener* listeners = s4c_gui_inner_calloc(capacity, sizeof(ToggleMenu_Listener));
+        if (listeners == NULL) return false;
+        if (changes->num_listeners > 0) memcpy(listeners, changes->listeners, changes->num_listeners * sizeof(ToggleMenu_Listener));
+        s4c_gui_inner_free(changes->listeners);
+        changes->listeners = listeners;
+        changes->listeners_capacity = capacity;
+    }
+    changes->listeners[changes->num_listeners++] = (ToggleMenu_Listener) {
+        .handler = handler,
+        .arg = arg,
+    };
+    return true;
+}
+
+static void compact_ToggleMenu_listeners(ToggleMenu_Changes changes)
+{
+    int kept = 0;
+    for (int i = 0; i < changes->num_listeners; i++) {
+        if (changes->listeners[i].handler != NULL) changes->listeners[kept++] = changes->listeners[i];
+    }
+    changes->num_listeners = kept;
+}
+
+/*
+ * Removes the listener added with the same handler and arg. Can be called from within a handler.
+ */
+void remove_ToggleMenu_listener(ToggleMenu toggle_menu, ToggleMenu_Change_Handler* handler, void* arg)
+{
+    ToggleMenu_Changes changes = toggle_menu.changes;
+    if (changes == NULL) return;
+    for (int i = 0; i < changes->num_listeners; i++) {
+        if (changes->listeners[i].handler == handler && changes->listeners[i].arg == arg) {
+            changes->listeners[i].handler = NULL;
+            break;
+        }
+    }
+    // Handlers being called are skipped once removed, the array is compacted after them
+    if (!changes->delivering) compact_ToggleMenu_listeners(changes);
+}
+
+/*
+ * Delivers the toggles changed since the last batch to every listener, as one batch.
+ * Called after each input event and when the menu is closed: call it after changing toggles from elsewhere,
+ * like with apply_ToggleMenu_state(). Does nothing when nothing changed, or when called from a handler.
+ */
+void notify_ToggleMenu_changes(ToggleMenu toggle_menu)
+{
+    ToggleMenu_Changes changes = toggle_menu.changes;
+    if (changes == NULL || changes->count == 0 || changes->delivering) return;
+    // Swap the bitsets, so handlers changing toggles fill the next batch
+    uint64_t* bits = changes->pending;
+    changes->pending = changes->batch;
+    changes->batch = bits;
+    ToggleMenu_ChangeBatch batch = {
+        .bits = bits,
+        .num_toggles = changes->num_toggles,
+        .count = changes->count,
+    };
+    changes->count = 0;
+    changes->delivering = true;
+    for (int i = 0; i < changes->num_listeners; i++) {
+        if (changes->listeners[i].handler != NULL) changes->listeners[i].handler(toggle_menu, &batch, changes->listeners[i].arg);
+    }
+    changes->delivering = false;
+    compact_ToggleMenu_listeners(changes);
+    memset(bits, 0, changes->num_words * sizeof(uint64_t));
+}
+
+/*
+ * Returns the first toggle in the batch from index from on, or -1 when there's none.
+ */
+int next_ToggleMenu_change(const ToggleMenu_ChangeBatch* batch, int from)
+{
+    assert(batch!=NULL);
+    if (from < 0) from = 0;
+    if (from >= batch->num_toggles) return -1;
+    int word_index = from / 64;
+    uint64_t word = batch->bits[word_index] & (~(uint64_t) 0 << (from % 64));
+    int num_words = (batch->num_toggles + 63) / 64;
+    while (word == 0) {
+        if (++word_index == num_words) return -1;
+        word = batch->bits[word_index];
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    return word_index * 64 + __builtin_ctzll(word);
+#else
+    int bit = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        bit++;
+    }
+    return word_index * 64 + bit;
+#endif
+}
+
+typedef struct ToggleMenu_Update {
+    atomic_size_t sequence; // Position it can be posted at, plus one once it's ready to be applied
+    int toggle_index;
+    ToggleType type;
+    int value; // bool_state or current_state
+    char text[TOGGLEMENU_UPDATE_TEXT_MAX];
+} ToggleMenu_Update;
+
+/*
+ * Bounded MPSC ring: producers claim slots by bumping tail, the thread handling the menu pops them from head.
+ * Each slot sequence tells whether it's free, being filled or ready, so no lock is taken.
+ */
+struct ToggleMenu_UpdateQueue_s {
+    ToggleMenu_Update* slots;
+    size_t mask; // Capacity minus one, capacity being a power of two
+    atomic_size_t tail; // Next position to post at
+    size_t head; // Next position to apply, only touched by the consumer
+    atomic_bool wake_pending; // A byte is in the pipe, or is about to be
+    int wake_fds[2]; // Self-pipe, -1 when unavailable
+};
+
+/*
+ * Returns a queue holding up to capacity pending updates, rounded up to a power of two.
+ * Attach it to a ToggleMenu through its updates field, then post from any thread.
+ */
+ToggleMenu_UpdateQueue new_ToggleMenu_UpdateQueue(int capacity)
+{
+    size_t size = 2;
+    while (size < (size_t) capacity) size *= 2;
+    ToggleMenu_UpdateQueue res = s4c_gui_inner_calloc(1, sizeof(struct ToggleMenu_UpdateQueue_s));
+    if (res == NULL) return NULL;
+    res->slots = s4c_gui_inner_calloc(size, sizeof(ToggleMenu_Update));
+    if (res->slots == NULL) {
+        s4c_gui_inner_free(res);
+        return NULL;
+    }
+    res->mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&(res->slots[i].sequence), i);
+    }
+    atomic_init(&(res->tail), 0);
+    atomic_init(&(res->wake_pending), false);
+    res->wake_fds[0] = -1;
+    res->wake_fds[1] = -1;
+#ifndef _WIN32
+    if (pipe(res->wake_fds) == 0) {
+        // Neither a full pipe nor an empty one may block
+        fcntl(res->wake_fds[0], F_SETFL, fcntl(res->wake_fds[0], F_GETFL) | O_NONBLOCK);
+        fcntl(res->wake_fds[1], F_SETFL, fcntl(res->wake_fds[1], F_GETFL) | O_NONBLOCK);
+    } else {
+        res->wake_fds[0] = -1;
+        res->wake_fds[1] = -1;
+    }
+#endif // _WIN32
+    return res;
+}
+
+/*
+ * Must only be called once no thread posts to the queue anymore, and no ToggleMenu uses it.
+ */
+void free_ToggleMenu_UpdateQueue(ToggleMenu_UpdateQueue queue)
+{
+    if (queue == NULL) return;
+#ifndef _WIN32
+    if (queue->wake_fds[0] >= 0) {
+        close(queue->wake_fds[0]);
+        close(queue->wake_fds[1]);
+    }
+#endif // _WIN32
+    s4c_gui_inner_free(queue->slots);
+    s4c_gui_inner_free(queue);
+}
+
+/*
+ * Returns the read end of the queue self-pipe, readable once updates are posted, or -1 when there's none.
+ * Add it to a poll() set next to get_s4c_gui_input_fd() when driving the menu with step functions.
+ */
+int get_ToggleMenu_UpdateQueue_fd(ToggleMenu_UpdateQueue queue)
+{
+    assert(queue!=NULL);
+    return queue->wake_fds[0];
+}
+
+/*
+ * Claims a slot, fills it and publishes it, then wakes the consumer unless a wake is already pending.
+ * Returns false when the queue is full.
+ */
+static bool post_ToggleMenu_update(ToggleMenu_UpdateQueue queue, int toggle_index, ToggleType type, int value, const char* text)
+{
+    assert(queue!=NULL);
+    ToggleMenu_Update* slot = NULL;
+    size_t pos = atomic_load_explicit(&(queue->tail), memory_order_relaxed);
+    for (;;) {
+        slot = &(queue->slots[pos & queue->mask]);
+        size_t sequence = atomic_load_explicit(&(slot->sequence), memory_order_acquire);
+        if (sequence == pos) {
+            if (atomic_compare_exchange_weak_explicit(&(queue->tail), &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) break;
+        } else if ((ptrdiff_t) (sequence - pos) < 0) {
+            // The consumer hasn't applied this slot from the previous lap yet
+            return false;
+        } else {
+            pos = atomic_load_explicit(&(queue->tail), memory_order_relaxed);
+        }
+    }
+    slot->toggle_index = toggle_index;
+    slot->type = type;
+    slot->value = value;
+    if (text != NULL) {
+        size_t len = strlen(text);
+        if (len >= TOGGLEMENU_UPDATE_TEXT_MAX) len = TOGGLEMENU_UPDATE_TEXT_MAX - 1;
+        memcpy(slot->text, text, len);
+        slot->text[len] = '\0';
+    }
+    atomic_store_explicit(&(slot->sequence), pos + 1, memory_order_release);
+
+#ifndef _WIN32
+    if (queue->wake_fds[1] >= 0 && !atomic_exchange(&(queue->wake_pending), true)) {
+        char byte = 0;
+        // A full pipe already wakes the consumer
+        ssize_t written = write(queue->wake_fds[1], &byte, 1);
+        (void) written;
+    }
+#endif // _WIN32
+    return true;
+}
+
+/*
+ * Posts a new bool_state for a BOOL_TOGGLE. Can be called from any thread.
+ * Returns false when the queue is full: the update is dropped.
+ */
+bool post_ToggleMenu_bool(ToggleMenu_UpdateQueue queue, int toggle_index, bool value)
+{
+    return post_ToggleMenu_update(queue, toggle_index, BOOL_TOGGLE, value, NULL);
+}
+
+/*
+ * Posts a new current_state for a MULTI_STATE_TOGGLE. Can be called from any thread.
+ * Returns false when the queue is full: the update is dropped.
+ */
+bool post_ToggleMenu_multi(ToggleMenu_UpdateQueue queue, int toggle_index, int current_state)
+{
+    return post_ToggleMenu_update(queue, toggle_index, MULTI_STATE_TOGGLE, current_state, NULL);
+}
+
+/*
+ * Posts a new value for a TEXTFIELD_TOGGLE, cut to TOGGLEMENU_UPDATE_TEXT_MAX - 1 chars. Can be called from any thread.
+ * Returns false when the queue is full: the update is dropped.
+ */
+bool post_ToggleMenu_text(ToggleMenu_UpdateQueue queue, int toggle_index, const char* text)
+{
+    assert(text!=NULL);
+    return post_ToggleMenu_update(queue, toggle_index, TEXTFIELD_TOGGLE, 0, text);
+}
+
+/*
+ * Applies the posted updates, in order, to the toggles of the menu. Updates for skip, a TextField being edited, are dropped,
+ * like the ones for toggles out of range or of another type. Updates to the value a toggle already has change nothing,
+ * so they don't mark it dirty. Returns how many changed a toggle.
+ */
+static int drain_ToggleMenu_updates(ToggleMenu toggle_menu, TextField skip)
+{
+    ToggleMenu_UpdateQueue queue = toggle_menu.updates;
+    if (queue == NULL) return 0;
+#ifndef _WIN32
+    if (atomic_load_explicit(&(queue->wake_pending), memory_order_relaxed)) {
+        char buf[64];
+        while (read(queue->wake_fds[0], buf, sizeof(buf)) > 0);
+        // Cleared before popping: updates posted from now on wake us again
+        atomic_store(&(queue->wake_pending), false);
+    }
+#endif // _WIN32
+    int res = 0;
+    for (;;) {
+        ToggleMenu_Update* slot = &(queue->slots[queue->head & queue->mask]);
+        if (atomic_load_explicit(&(slot->sequence), memory_order_acquire) != queue->head + 1) break;
+        int i = slot->toggle_index;
+        if (i >= 0 && i < toggle_menu.num_toggles && toggle_menu.toggles[i].type == slot->type) {
+            Toggle* toggle = &(toggle_menu.toggles[i]);
+            bool applied = true;
+            switch (slot->type) {
+            case BOOL_TOGGLE: {
+                applied = (toggle->state.bool_state != (slot->value != 0));
+                if (applied) toggle->state.bool_state = slot->value;
+            }
+            break;
+            case MULTI_STATE_TOGGLE: {
+                applied = (slot->value >= 0 && slot->value < toggle->state.ts_state.num_states && slot->value != toggle->state.ts_state.current_state);
+                if (applied) toggle->state.ts_state.current_state = slot->value;
+            }
+            break;
+            case TEXTFIELD_TOGGLE: {
+                TextField txt = toggle->state.txt_state;
+                int len = strlen(slot->text);
+                if (len > txt->max_length) len = txt->max_length;
+                applied = (txt != skip && (len != txt->length || memcmp(get_TextField_value(txt), slot->text, len) != 0));
+                if (applied) set_TextField_value(txt, slot->text, len);
+            }
+            break;
+            }
+            if (applied) {
+                mark_ToggleMenu_dirty(toggle_menu, i);
+                res++;
+            }
+        }
+        // Hand the slot back to the producers, for the next lap
+        atomic_store_explicit(&(slot->sequence), queue->head + queue->mask + 1, memory_order_release);
+        queue->head++;
+    }
+    return res;
+}
+
+/*
+ * Applies the updates posted to toggle_menu.updates, marking the toggles they change dirty. Returns how many changed a toggle.
+ * A handled ToggleMenu does it on its own: call it when drawing the states from your own loop instead.
+ */
+int apply_ToggleMenu_updates(ToggleMenu toggle_menu)
+{
+    return drain_ToggleMenu_updates(toggle_menu, NULL);
+}
+
+static void free_ToggleMenu_SearchIndex(ToggleMenu_SearchIndex search)
+{
+    if (search == NULL) return;
+    clear_ToggleMenu_SearchIndex(search);
+    s4c_gui_inner_free(search);
+}
+
+/*
+ * Narrows the range [*lo, *hi) of sorted keys to the ones starting with the first len chars of query.
+ * The range must already hold every match, so each added char costs two binary searches over what's left.
+ */
+static void narrow_ToggleMenu_SearchIndex(ToggleMenu_SearchIndex search, const char* query, size_t len, int* lo, int* hi)
+{
+    int first = *lo;
+    int last = *hi;
+    while (first < last) {
+        int mid = first + (last - first) / 2;
+        if (compare_ToggleMenu_search_text(search->keys[mid].text, query, len) < 0) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+    *lo = first;
+    last = *hi;
+    while (first < last) {
+        int mid = first + (last - first) / 2;
+        if (compare_ToggleMenu_search_text(search->keys[mid].text, query, len) == 0) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+    *hi = first;
+}
+
+/*
+ * Returns the smallest toggle not below from among the keys in [lo, hi) of the given wavelet matrix level,
+ * or -1 when there's none. value holds the bits of the toggle picked by the levels above, which match from's.
+ */
+static int find_ToggleMenu_search_toggle(ToggleMenu_SearchIndex search, int level, int lo, int hi, int from, int value)
+{
+    if (lo >= hi) return -1;
+    if (level == search->toggle_levels) return value;
+    int bit = search->toggle_levels - 1 - level;
+    const uint64_t* row = search->toggle_bits + (size_t)level * search->toggle_words;
+    const int* ranks = search->toggle_ranks + (size_t)level * search->toggle_words;
+    int lo_ones = ranks[lo / 64] + __builtin_popcountll(row[lo / 64] & (((uint64_t)1 << (lo % 64)) - 1));
+    int hi_ones = ranks[hi / 64] + __builtin_popcountll(row[hi / 64] & (((uint64_t)1 << (hi % 64)) - 1));
+    if (((from >> bit) & 1) == 0) {
+        int res = find_ToggleMenu_search_toggle(search, level + 1, lo - lo_ones, hi - hi_ones, from, value);
+        if (res >= 0) return res;
+        // Anything with the bit set is above from
+        from = value | (1 << bit);
+    }
+    int zeros = search->toggle_zeros[level];
+    return find_ToggleMenu_search_toggle(search, level + 1, zeros + lo_ones, zeros + hi_ones, from, value | (1 << bit));
+}
+
+/*
+ * Returns the first toggle from the passed one on, wrapping around, among the keys in [lo, hi).
+ * Returns -1 when the range is empty. Takes O(log num_toggles) whatever the size of the range.
+ */
+static int pick_ToggleMenu_search_match(ToggleMenu_SearchIndex search, int lo, int hi, int from)
+{
+    if (lo >= hi) return -1;
+    int res = -1;
+    if (from < 0) from = 0;
+    if (from < search->num_toggles) res = find_ToggleMenu_search_toggle(search, 0, lo, hi, from, 0);
+    return (res >= 0 ? res : find_ToggleMenu_search_toggle(search, 0, lo, hi, 0, 0));
+}
+
+ToggleMenu new_ToggleMenu_(Toggle* toggles, int num_toggles, ToggleMenu_Conf conf)
+{
+    int rows = num_toggles;
+    if (conf.virtualized) {
+        // Only the rows in view are ever drawn
+        rows = ((conf.height > 2) ? conf.height - 2 : TOGGLEMENU_VIRTUAL_DEFAULT_ROWS);
+        if (rows > num_toggles) rows = num_toggles;
+    }
+    // A virtualized menu only measures its first page: the state window measures the rows in view as they're drawn
+    ToggleMenu_Layout layout = new_ToggleMenu_Layout(toggles, rows);
+    size_t widest_label_size = 0;
+    if (conf.virtualized && conf.width > 2) {
+        widest_label_size = conf.width - 2;
+    } else if (layout != NULL && layout->label_max < TOGGLEMENU_COLUMN_MAX) {
+        widest_label_size = layout->label_max;
+    } else {
+        // The layout cuts labels at TOGGLEMENU_COLUMN_MAX, but the MENU needs room for all of them
+        for (size_t i=0; i < rows; i++) {
+            size_t curr_size = strlen(toggles[i].label);
+            if (curr_size > widest_label_size) widest_label_size = curr_size;
+        }
+    }
+    return (ToggleMenu) {
+        .toggles = toggles,
+        .num_toggles = num_toggles,
+        .height = rows+2,
+        .width = widest_label_size+2,
+        .start_x = conf.start_x,
+        .start_y = conf.start_y,
+        .boxed = conf.boxed,
+        .quit_key = ((conf.quit_key < 0) ? TOGGLE_MENU_DEFAULT_QUIT_KEY : conf.quit_key),
+        .statewin_height = conf.statewin_height,
+        .statewin_width = conf.statewin_width,
+        .statewin_start_x = conf.statewin_start_x,
+        .statewin_start_y = conf.statewin_start_y,
+        .statewin_boxed = conf.statewin_boxed,
+        .statewin_label = conf.statewin_label,
+        .key_up = conf.key_up,
+        .key_right = conf.key_right,
+        .key_down = conf.key_down,
+        .key_left = conf.key_left,
+        .get_mouse_events = conf.get_mouse_events,
+        .mouse_handler = conf.mouse_handler,
+        .mouse_events_mask = conf.mouse_events_mask,
+        .dirty = new_ToggleMenu_DirtySet(true), // First paint always covers the whole window
+        .relabeled = new_ToggleMenu_DirtySet(false),
+        .virtualized = conf.virtualized,
+        .first_visible = 0,
+        .keymap = conf.keymap,
+        .search = new_ToggleMenu_SearchIndex(),
+        .layout = layout,
+        .resize_handler = conf.resize_handler,
+        .changes = new_ToggleMenu_Changes(num_toggles),
+        .updates = conf.updates,
+    };
+}
+
+void default_ToggleMenu_mousehandler__(ToggleMenu toggle_menu, MEVENT* mouse_event)
+{
+    char msg[1024];
+    snprintf(msg, sizeof(msg), "[DEBUG] %s():    Got mouse event at {x: %i, y: %i, z: %i}\n"
+             "[DEBUG] %s():    Info on menu: {\n"
+             "[DEBUG]" ToggleMenu_Fmt "\n"
+             "[DEBUG] }\n", __func__, mouse_event->x, mouse_event->y, mouse_event->z, __func__, ToggleMenu_Arg(toggle_menu));
+    show_s4c_gui_notice(0, 0, msg, TOGGLEMENU_NOTICE_MSECS);
+}
+
+static const ToggleMenu_Conf TOGGLE_MENU_DEFAULT_CONF = {
+    .start_x = 0,
+    .start_y = 0,
+    .boxed = true,
+    .quit_key = TOGGLE_MENU_DEFAULT_QUIT_KEY,
+    .key_up = KEY_UP,
+    .key_right = KEY_RIGHT,
+    .key_down = KEY_DOWN,
+    .key_left = KEY_LEFT,
+};
+
+ToggleMenu new_ToggleMenu(Toggle* toggles, int num_toggles)
+{
+    return new_ToggleMenu_(toggles, num_toggles, TOGGLE_MENU_DEFAULT_CONF);
+}
+
+ToggleMenu new_ToggleMenu_with_mouse_mask(Toggle* toggles, int num_toggles, ToggleMenu_MouseEvent_Handler* mouse_events_handler, mmask_t mouse_events_mask)
+{
+    ToggleMenu res = new_ToggleMenu_(toggles, num_toggles, TOGGLE_MENU_DEFAULT_CONF);
+    res.get_mouse_events = true;
+    res.mouse_handler = mouse_events_handler;
+    res.mouse_events_mask = mouse_events_mask;
+    return res;
+}
+
+ToggleMenu new_ToggleMenu_with_mouse(Toggle* toggles, int num_toggles, ToggleMenu_MouseEvent_Handler* mouse_events_handler)
+{
+    return new_ToggleMenu_with_mouse_mask(toggles, num_toggles, mouse_events_handler, TOGGLEMENU_DEFAULT_MOUSEEVENTS_MASK);
+}
+
+/*
+ * Returns a ToggleMenu scrolling over the passed toggles, which are not copied.
+ * Pass height and width as 0 to use TOGGLEMENU_VIRTUAL_DEFAULT_ROWS and the widest label in the first page.
+ * Only the first page is looked at: building it takes the same time whatever num_toggles.
+ */
+ToggleMenu new_ToggleMenu_virtualized(Toggle* toggles, int num_toggles, int height, int width)
+{
+    ToggleMenu_Conf conf = TOGGLE_MENU_DEFAULT_CONF;
+    conf.virtualized = true;
+    conf.height = height;
+    conf.width = width;
+    return new_ToggleMenu_(toggles, num_toggles, conf);
+}
+
+void free_ToggleMenu(ToggleMenu toggle_menu)
+{
+    free_ToggleMenu_DirtySet(toggle_menu.dirty);
+    free_ToggleMenu_DirtySet(toggle_menu.relabeled);
+    free_ToggleMenu_SearchIndex(toggle_menu.search);
+    free_ToggleMenu_Layout(toggle_menu.layout);
+    free_ToggleMenu_Changes(toggle_menu.changes);
+    for (size_t i=0; i<toggle_menu.num_toggles; i++) {
+        switch (toggle_menu.toggles[i].type) {
+        case BOOL_TOGGLE:
+        case MULTI_STATE_TOGGLE: {
+            break;
+        }
+        case TEXTFIELD_TOGGLE: {
+            free_TextField(toggle_menu.toggles[i].state.txt_state);
+            break;
+        }
+        default: {
+            //Unexpected
+            assert(false);
+            break;
+        }
+        }
+    }
+}
+
+typedef struct ToggleMenu_Keymap_Entry {
+    ToggleMenu_Action action;
+    ToggleMenu_Key_Handler* handler; // Only for TOGGLEMENU_ACTION_USER
+    void* arg;
+    int chord; // Trie node for the keys that can follow, 0 when none
+} ToggleMenu_Keymap_Entry;
+
+typedef struct ToggleMenu_Keymap_Link {
+    int key;
+    ToggleMenu_Keymap_Entry entry;
+} ToggleMenu_Keymap_Link;
+
+typedef struct ToggleMenu_Keymap_Node {
+    ToggleMenu_Keymap_Link* links;
+    int count;
+    int capacity;
+} ToggleMenu_Keymap_Node;
+
+struct ToggleMenu_Keymap_s {
+    ToggleMenu_Keymap_Entry keys[KEY_MAX+1]; // Indexed by the first key of a binding
+    ToggleMenu_Keymap_Node* nodes; // Chord trie. Node 0 is never used
+    int num_nodes;
+    int nodes_capacity;
+};
+
+/*
+ * Returns a new ToggleMenu_Keymap with the bindings the passed ToggleMenu would use: its key_* fields, page keys, Enter, '/' to search and quit_key.
+ * Returns NULL on allocation failure. Free it with free_ToggleMenu_Keymap().
+ */
+ToggleMenu_Keymap new_ToggleMenu_Keymap(ToggleMenu toggle_menu)
+{
+    ToggleMenu_Keymap res = s4c_gui_inner_calloc(1, sizeof(struct ToggleMenu_Keymap_s));
+    if (res == NULL) return NULL;
+    res->num_nodes = 1;
+    // Bound from lowest to highest priority, so a key set in two fields keeps the old meaning
+    const struct {
+        int key;
+        ToggleMenu_Action action;
+    } defaults[] = {
+        { '/', TOGGLEMENU_ACTION_SEARCH },
+        { '\n', TOGGLEMENU_ACTION_ACTIVATE },
+        { (toggle_menu.get_mouse_events ? KEY_MOUSE : -1), TOGGLEMENU_ACTION_MOUSE },
+        { toggle_menu.key_left, TOGGLEMENU_ACTION_CYCLE },
+        { toggle_menu.key_right, TOGGLEMENU_ACTION_CYCLE },
+        { KEY_END, TOGGLEMENU_ACTION_LAST },
+        { KEY_HOME, TOGGLEMENU_ACTION_FIRST },
+        { KEY_PPAGE, TOGGLEMENU_ACTION_PAGE_UP },
+        { KEY_NPAGE, TOGGLEMENU_ACTION_PAGE_DOWN },
+        { toggle_menu.key_up, TOGGLEMENU_ACTION_UP },
+        { toggle_menu.key_down, TOGGLEMENU_ACTION_DOWN },
+        { toggle_menu.quit_key, TOGGLEMENU_ACTION_QUIT },
+    };
+    for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++) {
+        bind_ToggleMenu_Keymap(res, &(defaults[i].key), 1, defaults[i].action, NULL, NULL);
+    }
+    return res;
+}
+
+/*
+ * Returns the index of a new empty trie node, or 0 on allocation failure.
+ */
+static int new_ToggleMenu_Keymap_node(ToggleMenu_Keymap keymap)
+{
+    if (keymap->num_nodes >= keymap->nodes_capacity) {
+        int capacity = (keymap->nodes_capacity > 0 ? keymap->nodes_capacity * 2 : 8);
+        ToggleMenu_Keymap_Node* nodes = s4c_gui_inner_calloc(capacity, sizeof(ToggleMenu_Keymap_Node));
+        if (nodes == NULL) return 0;
+        if (keymap->nodes != NULL) {
+            memcpy(nodes, keymap->nodes, keymap->nodes_capacity * sizeof(ToggleMenu_Keymap_Node));
+            s4c_gui_inner_free(keymap->nodes);
+        }
+        keymap->nodes = nodes;
+        keymap->nodes_capacity = capacity;
+    }
+    return keymap->num_nodes++;
+}
+
+/*
+ * Returns the entry for key under the passed trie node, or NULL when there's none.
+ * When add is true, a missing entry is added unbound.
+ */
+static ToggleMenu_Keymap_Entry* find_ToggleMenu_Keymap_link(ToggleMenu_Keymap keymap, int node_index, int key, bool add)
+{
+    ToggleMenu_Keymap_Node* node = &(keymap->nodes[node_index]);
+    for (int i = 0; i < node->count; i++) {
+        if (node->links[i].key == key) return &(node->links[i].entry);
+    }
+    if (!add) return NULL;
+    if (node->count == node->capacity) {
+        int capacity = (node->capacity > 0 ? node->capacity * 2 : 4);
+        ToggleMenu_Keymap_Link* links = s4c_gui_inner_calloc(capacity, sizeof(ToggleMenu_Keymap_Link));
+        if (links == NULL) return NULL;
+        if (node->links != NULL) {
+            memcpy(links, node->links, node->count * sizeof(ToggleMenu_Keymap_Link));
+            s4c_gui_inner_free(node->links);
+        }
+        node->links = links;
+        node->capacity = capacity;
+    }
+    ToggleMenu_Keymap_Link* link = &(node->links[node->count++]);
+    memset(link, 0, sizeof(ToggleMenu_Keymap_Link));
+    link->key = key;
+    return &(link->entry);
+}
+
+/*
+ * Binds the sequence of num_keys keys to action. Pass more than one key to bind a chord, up to TOGGLEMENU_CHORD_MAX.
+ * handler and arg are only used for TOGGLEMENU_ACTION_USER. Binding TOGGLEMENU_ACTION_NONE removes a binding.
+ * A key that starts a chord can't act on its own: binding a chord drops the binding of each of its prefixes.
+ * Returns false when a key is out of 0..KEY_MAX, the sequence starts a bound chord, or on allocation failure.
+ */
+bool bind_ToggleMenu_Keymap(ToggleMenu_Keymap keymap, const int* keys, int num_keys, ToggleMenu_Action action, ToggleMenu_Key_Handler* handler, void* arg)
+{
+    if (keymap == NULL || keys == NULL || num_keys < 1 || num_keys > TOGGLEMENU_CHORD_MAX) return false;
+    for (int i = 0; i < num_keys; i++) {
+        if (keys[i] < 0 || keys[i] > KEY_MAX) return false;
+    }
+    if (action == TOGGLEMENU_ACTION_USER && handler == NULL) return false;
+
+    ToggleMenu_Keymap_Entry* entry = &(keymap->keys[keys[0]]);
+    for (int i = 1; i < num_keys; i++) {
+        if (entry->chord == 0) {
+            if (action == TOGGLEMENU_ACTION_NONE) return true;
+            // The entry may live in a node's links, which new nodes don't move
+            int chord = new_ToggleMenu_Keymap_node(keymap);
+            if (chord == 0) return false;
+            entry->chord = chord;
+        }
+        entry->action = TOGGLEMENU_ACTION_NONE;
+        entry = find_ToggleMenu_Keymap_link(keymap, entry->chord, keys[i], (action != TOGGLEMENU_ACTION_NONE));
+        if (entry == NULL) return (action == TOGGLEMENU_ACTION_NONE);
+    }
+    if (entry->chord != 0) return false;
+    entry->action = action;
+    entry->handler = (action == TOGGLEMENU_ACTION_USER ? handler : NULL);
+    entry->arg = (action == TOGGLEMENU_ACTION_USER ? arg : NULL);
+    return true;
+}
+
+/*
+ * Returns the bound entry reached by key, or NULL when key is unbound or starts a chord.
+ * chord holds the trie node of a chord being typed, 0 when none: a key that doesn't continue it is looked up on its own.
+ */
+static const ToggleMenu_Keymap_Entry* lookup_ToggleMenu_Keymap(ToggleMenu_Keymap keymap, int* chord, int key)
+{
+    const ToggleMenu_Keymap_Entry* res = NULL;
+    if (*chord != 0) {
+        res = find_ToggleMenu_Keymap_link(keymap, *chord, key, false);
+        *chord = 0;
+    }
+    if (res == NULL) {
+        if (key < 0 || key > KEY_MAX) return NULL;
+        res = &(keymap->keys[key]);
+    }
+    if (res->chord != 0) {
+        *chord = res->chord;
+        return NULL;
+    }
+    return ((res->action != TOGGLEMENU_ACTION_NONE) ? res : NULL);
+}
+
+void free_ToggleMenu_Keymap(ToggleMenu_Keymap keymap)
+{
+    if (keymap == NULL) return;
+    for (int i = 1; i < keymap->num_nodes; i++) {
+        s4c_gui_inner_free(keymap->nodes[i].links);
+    }
+    s4c_gui_inner_free(keymap->nodes);
+    s4c_gui_inner_free(keymap);
+}
+
+/*
+ * Returns the index of the first toggle from the passed one on, wrapping around, with a word in its label starting with prefix.
+ * Case is ignored. Returns -1 when there's none.
+ * Labels are matched as they were at the first search since the menu was made or a toggle was invalidated.
+ */
+int find_ToggleMenu_label(ToggleMenu toggle_menu, const char* prefix, int from)
+{
+    ToggleMenu_SearchIndex search = use_ToggleMenu_SearchIndex(toggle_menu);
+    if (search == NULL || prefix == NULL) return -1;
+    int lo = 0;
+    int hi = search->count;
+    narrow_ToggleMenu_SearchIndex(search, prefix, strlen(prefix), &lo, &hi);
+    return pick_ToggleMenu_search_match(search, lo, hi, from);
+}
+
+/*
+ * Queues the state row of the toggle for repaint, measuring its label and value again.
+ * When that changes a column width every row is repainted, since the columns after it move.
+ */
+static void queue_ToggleMenu_row(ToggleMenu toggle_menu, int toggle_index)
+{
+    bool moved = (toggle_menu.layout != NULL && measure_ToggleMenu_Layout(toggle_menu.layout, toggle_menu.toggles, toggle_index));
+    if (moved) {
+        mark_ToggleMenu_all_dirty(toggle_menu);
+        return;
+    }
+    // Too many changes for one event turn into a full repaint
+    add_ToggleMenu_DirtySet(toggle_menu.dirty, toggle_index);
+}
+
+/*
+ * Queues the state row of the toggle for repaint and records it as changed for the listeners.
+ */
+void mark_ToggleMenu_dirty(ToggleMenu toggle_menu, int toggle_index)
+{
+    assert(toggle_index >= 0 && toggle_index < toggle_menu.num_toggles);
+    if (toggle_menu.changes != NULL) record_ToggleMenu_change(toggle_menu.changes, toggle_index);
+    queue_ToggleMenu_row(toggle_menu, toggle_index);
+}
+
+/*
+ * Tells the menu the label or lock of the toggle changed: labels may be edited in place or replaced.
+ * Its state row is repainted, the search index is built again on the next search, and views pick it up when next shown.
+ * Doesn't count as a change for the listeners.
+ */
+void invalidate_ToggleMenu_toggle(ToggleMenu toggle_menu, int toggle_index)
+{
+    assert(toggle_index >= 0 && toggle_index < toggle_menu.num_toggles);
+    if (toggle_menu.search != NULL) clear_ToggleMenu_SearchIndex(toggle_menu.search);
+    queue_ToggleMenu_row(toggle_menu, toggle_index);
+    add_ToggleMenu_DirtySet(toggle_menu.relabeled, toggle_index);
+}
 
-    const int max_length = txt_field->max_length;
+void mark_ToggleMenu_all_dirty(ToggleMenu toggle_menu)
+{
+    if (toggle_menu.dirty == NULL) return;
+    toggle_menu.dirty->all = true;
+}
 
-    const int input_start_x = 1;
-    // Move the cursor to the input field position
-    wmove(win, 1, input_start_x);
+/*
+ * Returns how many state rows fit in the state window, starting from toggle_menu.first_visible.
+ */
+static int ToggleMenu_state_rows(WINDOW* win, ToggleMenu toggle_menu)
+{
+    int rows = getmaxy(win) - 1;
+    if (toggle_menu.statewin_boxed) rows--;
+    if (rows > toggle_menu.num_toggles - toggle_menu.first_visible) rows = toggle_menu.num_toggles - toggle_menu.first_visible;
+    return (rows > 0 ? rows : 0);
+}
 
-    // Get input from the user
-    int ch;
-    while ((ch = wgetch(win)) != '\n') {
-        // Check for backspace
-        if (ch == KEY_BACKSPACE || ch == '\b' || ch == 127) {
-            if (*length > 0) {
-                // Erase the character
-                mvwaddch(win, 1, *length, ' ');
-                wrefresh(win);
-                // Move cursor back
-                wmove(win, 1, *length);
-                buffer[(*length)-1] = '\0';
-                (*length)--;
-                if (*length == 0 && txt_field->prompt != NULL) {
-                    //Redraw prompt
-                    mvwprintw(win, 1, 1, "%s", txt_field->prompt);
-                    wmove(win, 1, input_start_x);
-                }
+/*
+ * Prints the state row for the toggle at index i.
+ * When blank is true, the row is erased first, leaving the box border untouched.
+ */
+static void draw_ToggleMenu_state_row(WINDOW* win, ToggleMenu toggle_menu, int i, bool blank)
+{
+    Toggle* toggles = toggle_menu.toggles;
+    int row = i - toggle_menu.first_visible + 1;
+
+    if (blank) {
+        int blank_width = getmaxx(win) - (toggle_menu.statewin_boxed ? 2 : 1);
+        if (blank_width > 0) mvwhline(win, row, 1, ' ', blank_width);
+        count_s4c_gui_op(S4C_GUI_WIDGET_STATEWIN, S4C_GUI_OP_PRINT);
+    }
+
+    // Columns come from the layout, or fixed ones when it couldn't be allocated
+    ToggleMenu_Layout layout = toggle_menu.layout;
+    int value_col = (layout != NULL ? layout->label_max + 3 : 20);
+    int lock_col = (layout != NULL ? value_col + layout->value_max + 1 : 30);
+    int end_col = getmaxx(win) - (toggle_menu.statewin_boxed ? 1 : 0);
+
+    // Print toggle label
+    if (end_col > 1) {
+        mvwaddnstr(win, row, 1, toggles[i].label, end_col - 1);
+        if (getcurx(win) < end_col) waddch(win, ':');
+    }
+    count_s4c_gui_op(S4C_GUI_WIDGET_STATEWIN, S4C_GUI_OP_PRINT);
+
+    // Print toggle state
+    char buf[TOGGLEMENU_VALUE_MAX];
+    int value_width = 0;
+    const char* value = format_ToggleMenu_value(&(toggles[i]), buf, sizeof(buf), &value_width);
+    if (value_col < end_col) mvwaddnstr(win, row, value_col, value, end_col - value_col);
+    count_s4c_gui_op(S4C_GUI_WIDGET_STATEWIN, S4C_GUI_OP_PRINT);
+
+    // Print lock indicator
+    if (toggles[i].locked) {
+        if (lock_col < end_col) mvwaddnstr(win, row, lock_col, "(LOCKED)", end_col - lock_col);
+        count_s4c_gui_op(S4C_GUI_WIDGET_STATEWIN, S4C_GUI_OP_PRINT);
+    }
+}
+
+/*
+ * Repaints every state row into the window buffer, without refreshing.
+ * werase() is used instead of wclear() so the next refresh only sends changed cells.
+ */
+static void paint_ToggleMenu_states(WINDOW* win, ToggleMenu toggle_menu)
+{
+    werase(win);
+    count_s4c_gui_op(S4C_GUI_WIDGET_STATEWIN, S4C_GUI_OP_CLEAR);
+
+    if (toggle_menu.statewin_boxed) {
+        box(win, 0, 0);
+        count_s4c_gui_op(S4C_GUI_WIDGET_STATEWIN, S4C_GUI_OP_BOX);
+    }
+    if (toggle_menu.statewin_label != NULL) {
+        mvwprintw(win, 0, 1, "%s", toggle_menu.statewin_label);
+        count_s4c_gui_op(S4C_GUI_WIDGET_STATEWIN, S4C_GUI_OP_PRINT);
+    }
+
+    int rows = ToggleMenu_state_rows(win, toggle_menu);
+    // A virtualized menu only measures the rows in view, again on each full paint since it draws them all anyway
+    if (toggle_menu.virtualized && toggle_menu.layout != NULL) {
+        measure_ToggleMenu_Layout_rows(toggle_menu.layout, toggle_menu.toggles, toggle_menu.first_visible, rows);
+    }
+    for (int i = 0; i < rows; i++) {
+        draw_ToggleMenu_state_row(win, toggle_menu, toggle_menu.first_visible + i, false);
+    }
+
+    if (toggle_menu.dirty != NULL) {
+        toggle_menu.dirty->count = 0;
+        toggle_menu.dirty->all = false;
+    }
+}
+
+void draw_ToggleMenu_states(WINDOW *win, ToggleMenu toggle_menu)
+{
+    paint_ToggleMenu_states(win, toggle_menu);
+    s4c_gui_wrefresh(win, S4C_GUI_WIDGET_STATEWIN);
+}
+
+/*
+ * Repaints only the rows marked in toggle_menu.dirty, then stages the window with wnoutrefresh().
+ * The caller is expected to call doupdate() once per input event.
+ * Falls back to a full repaint when no dirty set is available or a full repaint was requested.
+ */
+void draw_ToggleMenu_dirty_states(WINDOW *win, ToggleMenu toggle_menu)
+{
+    ToggleMenu_DirtySet* dirty = toggle_menu.dirty;
+    ToggleMenu_Layout layout = toggle_menu.layout;
+    // The rows of a virtualized menu moved since they were measured
+    bool scrolled = (toggle_menu.virtualized && layout != NULL && (layout->first != toggle_menu.first_visible || layout->count != ToggleMenu_state_rows(win, toggle_menu)));
+    if (dirty == NULL || dirty->all || scrolled) {
+        paint_ToggleMenu_states(win, toggle_menu);
+        s4c_gui_stage(win, S4C_GUI_WIDGET_STATEWIN);
+        return;
+    }
+    if (dirty->count == 0) return;
+
+    int rows = ToggleMenu_state_rows(win, toggle_menu);
+    for (int i = 0; i < dirty->count; i++) {
+        int toggle_index = dirty->toggles[i];
+        // Rows out of view can't be shown: drop them
+        if (toggle_index >= toggle_menu.first_visible && toggle_index < toggle_menu.first_visible + rows) {
+            draw_ToggleMenu_state_row(win, toggle_menu, toggle_index, true);
+        }
+    }
+    dirty->count = 0;
+    s4c_gui_stage(win, S4C_GUI_WIDGET_STATEWIN);
+}
+
+/*
+ * Holds the curses objects backing a ToggleMenu while it's being handled.
+ * In virtualized mode no MENU is built: only the rows in view are drawn into menu_sub.
+ */
+typedef struct ToggleMenu_View {
+    ToggleMenu toggle_menu;
+    WINDOW* menu_win;
+    WINDOW* menu_sub;
+    WINDOW* state_win;
+    MENU* nc_menu; // NULL in virtualized mode
+    ITEM** items; // NULL in virtualized mode
+    int rows; // Rows in view
+    int current; // Selected toggle, used in virtualized mode
+    bool shown;
+    TextField editing; // TextField toggle receiving input, if any
+    unsigned damage; // Value of s4c_gui_damage when last flushed
+    ToggleMenu_Keymap keymap;
+    bool owns_keymap; // Built from the ToggleMenu key fields at init
+    int chord; // Keymap trie node of the chord being typed, 0 when none
+    bool searching; // Typed keys go to the label search
+    char query[TOGGLEMENU_SEARCH_MAX+1];
+    int query_len;
+    int match_lo[TOGGLEMENU_SEARCH_MAX+1]; // Search index range matching each query prefix
+    int match_hi[TOGGLEMENU_SEARCH_MAX+1];
+    int menu_rows; // MENU format rows before any resize
+    int lines; // Screen size the windows were last fitted to
+    int cols;
+} ToggleMenu_View;
+
+static void draw_ToggleMenu_view_row(ToggleMenu_View* view, int row)
+{
+    WINDOW* sub = view->menu_sub;
+    int width = getmaxx(sub);
+    int i = view->toggle_menu.first_visible + row;
+    if (i >= view->toggle_menu.num_toggles) {
+        mvwhline(sub, row, 0, ' ', width);
+        count_s4c_gui_op(S4C_GUI_WIDGET_MENU, S4C_GUI_OP_PRINT);
+        return;
+    }
+    if (i == view->current) wattron(sub, A_REVERSE);
+    mvwprintw(sub, row, 0, "%-*.*s", width, width, view->toggle_menu.toggles[i].label);
+    count_s4c_gui_op(S4C_GUI_WIDGET_MENU, S4C_GUI_OP_PRINT);
+    if (i == view->current) wattroff(sub, A_REVERSE);
+}
+
+/*
+ * Selects the toggle at index target, scrolling the viewport as needed.
+ * Only the rows that scrolled in and the old and new selection are repainted.
+ */
+static void select_ToggleMenu_view_toggle(ToggleMenu_View* view, int target)
+{
+    ToggleMenu* toggle_menu = &(view->toggle_menu);
+    int prev = view->current;
+    int first = toggle_menu->first_visible;
+    if (target < first) {
+        first = target;
+    } else if (target >= first + view->rows) {
+        first = target - view->rows + 1;
+    }
+    view->current = target;
+
+    int delta = first - toggle_menu->first_visible;
+    toggle_menu->first_visible = first;
+    if (delta == 0) {
+        draw_ToggleMenu_view_row(view, prev - first);
+        draw_ToggleMenu_view_row(view, target - first);
+        return;
+    }
+    // The state window follows the viewport
+    mark_ToggleMenu_all_dirty(*toggle_menu);
+    if (abs(delta) >= view->rows) {
+        for (int row = 0; row < view->rows; row++) {
+            draw_ToggleMenu_view_row(view, row);
+        }
+        return;
+    }
+    scrollok(view->menu_sub, TRUE);
+    wscrl(view->menu_sub, delta);
+    scrollok(view->menu_sub, FALSE);
+    if (delta > 0) {
+        for (int row = view->rows - delta; row < view->rows; row++) {
+            draw_ToggleMenu_view_row(view, row);
+        }
+    } else {
+        for (int row = 0; row < -delta; row++) {
+            draw_ToggleMenu_view_row(view, row);
+        }
+    }
+    if (prev >= first && prev < first + view->rows) draw_ToggleMenu_view_row(view, prev - first);
+    draw_ToggleMenu_view_row(view, target - first);
+}
+
+/*
+ * Moves the selection according to a menu request, wrapping around at the ends like the MENU path does.
+ */
+static void move_ToggleMenu_view(ToggleMenu_View* view, int request)
+{
+    if (view->nc_menu != NULL) {
+        int res = menu_driver(view->nc_menu, request);
+        if (res == E_REQUEST_DENIED) {
+            if (request == REQ_DOWN_ITEM) {
+                res = menu_driver(view->nc_menu, REQ_FIRST_ITEM);
+            } else if (request == REQ_UP_ITEM) {
+                res = menu_driver(view->nc_menu, REQ_LAST_ITEM);
+            }
+        }
+        return;
+    }
+    int num_toggles = view->toggle_menu.num_toggles;
+    if (num_toggles == 0) return;
+    int target = view->current;
+    switch (request) {
+    case REQ_DOWN_ITEM: {
+        target = ((target + 1 < num_toggles) ? target + 1 : 0);
+    }
+    break;
+    case REQ_UP_ITEM: {
+        target = ((target > 0) ? target - 1 : num_toggles - 1);
+    }
+    break;
+    case REQ_SCR_DPAGE: {
+        target += view->rows;
+        if (target >= num_toggles) target = num_toggles - 1;
+    }
+    break;
+    case REQ_SCR_UPAGE: {
+        target -= view->rows;
+        if (target < 0) target = 0;
+    }
+    break;
+    case REQ_FIRST_ITEM: {
+        target = 0;
+    }
+    break;
+    case REQ_LAST_ITEM: {
+        target = num_toggles - 1;
+    }
+    break;
+    default: {
+        return;
+    }
+    break;
+    }
+    select_ToggleMenu_view_toggle(view, target);
+}
+
+/*
+ * Returns the selected toggle, or NULL if there's none or it is locked.
+ */
+static Toggle* get_ToggleMenu_view_selected(ToggleMenu_View* view)
+{
+    if (view->nc_menu != NULL) {
+        ITEM* item = current_item(view->nc_menu);
+        return ((item != NULL) ? (Toggle *)item_userptr(item) : NULL);
+    }
+    if (view->current < 0 || view->current >= view->toggle_menu.num_toggles) return NULL;
+    Toggle* toggle = &(view->toggle_menu.toggles[view->current]);
+    return (toggle->locked ? NULL : toggle);
+}
+
+
+/*
+ * Lets the MENU act on the toggle only while it is unlocked.
+ */
+static void bind_ToggleMenu_item(ITEM* item, Toggle* toggle)
+{
+    switch (toggle->type) {
+    case BOOL_TOGGLE: // Allow switching on bool toggle
+    case MULTI_STATE_TOGGLE: // Allow cycling through states for MULTI_STATE_TOGGLE toggles
+    case TEXTFIELD_TOGGLE: { // Allow changing textfield toggle
+        set_item_userptr(item, (toggle->locked ? NULL : toggle));
+    }
+    break;
+    default: {
+        set_item_userptr(item, NULL);
+    }
+    break;
+    }
+}
+
+static void new_ToggleMenu_View_sub(ToggleMenu_View* view)
+{
+    // Sized after the menu window, which may have been fitted to a resized screen
+    int height = getmaxy(view->menu_win);
+    int width = getmaxx(view->menu_win);
+    if (view->nc_menu != NULL) {
+        view->menu_sub = derwin(view->menu_win, height -1, width -2, 1, 1);
+        set_menu_sub(view->nc_menu, view->menu_sub);
+    } else {
+        view->menu_sub = derwin(view->menu_win, view->rows, width -2, 1, 1);
+        idlok(view->menu_sub, TRUE);
+    }
+}
+
+/*
+ * Creates the curses objects for the passed ToggleMenu, without drawing anything.
+ */
+static void init_ToggleMenu_View(ToggleMenu_View* view, ToggleMenu toggle_menu)
+{
+    memset(view, 0, sizeof(ToggleMenu_View));
+    view->toggle_menu = toggle_menu;
+    view->lines = LINES;
+    view->cols = COLS;
+    view->toggle_menu.first_visible = 0;
+    view->rows = toggle_menu.height - 2;
+    if (view->rows < 0) view->rows = 0;
+    view->keymap = toggle_menu.keymap;
+    if (view->keymap == NULL) {
+        // Built here, since the key fields may be set after new_ToggleMenu()
+        view->keymap = new_ToggleMenu_Keymap(toggle_menu);
+        view->owns_keymap = true;
+    }
+
+    if (toggle_menu.statewin_width > 0 && toggle_menu.statewin_height > 0) {
+        // Create a window for toggle states
+        view->state_win = newwin(toggle_menu.statewin_height, toggle_menu.statewin_width, toggle_menu.statewin_start_y, toggle_menu.statewin_start_x);
+    }
+
+    Toggle* toggles = toggle_menu.toggles;
+    int num_toggles = toggle_menu.num_toggles;
+
+    if (!toggle_menu.virtualized) {
+        // Create MENU for toggles
+        view->items = (ITEM **)s4c_gui_inner_calloc(num_toggles + 1, sizeof(ITEM *));
+        for (int i = 0; i < num_toggles; i++) {
+            view->items[i] = new_item(toggles[i].label, "");
+            bind_ToggleMenu_item(view->items[i], &toggles[i]);
+        }
+        view->items[num_toggles] = NULL;
+        view->nc_menu = new_menu(view->items);
+        menu_format(view->nc_menu, &(view->menu_rows), NULL);
+    }
+
+    // Create a window for the MENU
+    view->menu_win = newwin(toggle_menu.height, toggle_menu.width, toggle_menu.start_y, toggle_menu.start_x);
+    keypad(view->menu_win, TRUE);
+    if (view->nc_menu != NULL) {
+        set_menu_win(view->nc_menu, view->menu_win);
+        set_menu_mark(view->nc_menu, "");
+    }
+    new_ToggleMenu_View_sub(view);
+}
+
+/*
+ * Rebuilds the ITEMs of the toggles passed to invalidate_ToggleMenu_toggle() since the view was last shown, or all of
+ * them when there were too many to keep track of. A virtualized view has none: it draws the labels as they are.
+ * Must be called while the MENU is not posted.
+ */
+static void sync_ToggleMenu_View_items(ToggleMenu_View* view)
+{
+    Toggle* toggles = view->toggle_menu.toggles;
+    int num_toggles = view->toggle_menu.num_toggles;
+    ToggleMenu_DirtySet* relabeled = view->toggle_menu.relabeled;
+    if (relabeled == NULL || (relabeled->count == 0 && !relabeled->all)) return;
+    int count = (relabeled->all ? num_toggles : relabeled->count);
+    if (view->nc_menu != NULL && count > 0) {
+        // Items can only be replaced while they're not connected to the MENU
+        ITEM* current = current_item(view->nc_menu);
+        int current_index = ((current != NULL) ? item_index(current) : 0);
+        set_menu_items(view->nc_menu, NULL);
+        int widest = view->toggle_menu.width - 2;
+        for (int j = 0; j < count; j++) {
+            int i = (relabeled->all ? j : relabeled->toggles[j]);
+            free_item(view->items[i]);
+            view->items[i] = new_item(toggles[i].label, "");
+            bind_ToggleMenu_item(view->items[i], &toggles[i]);
+            int len = strlen(toggles[i].label);
+            if (len > widest) widest = len;
+        }
+        if (widest > view->toggle_menu.width - 2) {
+            // Grow the window to fit the new labels
+            view->toggle_menu.width = widest + 2;
+            delwin(view->menu_sub);
+            fit_s4c_gui_win(view->menu_win, view->toggle_menu.height, view->toggle_menu.width, view->toggle_menu.start_y, view->toggle_menu.start_x);
+            new_ToggleMenu_View_sub(view);
+        }
+        set_menu_items(view->nc_menu, view->items);
+        if (current_index < num_toggles) set_current_item(view->nc_menu, view->items[current_index]);
+    }
+    relabeled->count = 0;
+    relabeled->all = false;
+}
+
+static void resize_ToggleMenu_View(ToggleMenu_View* view);
+
+/*
+ * Draws the view. Windows that already exist are only touched, so unchanged cells are not resent.
+ */
+static void show_ToggleMenu_View(ToggleMenu_View* view)
+{
+    if (view->shown) return;
+    sync_ToggleMenu_View_items(view);
+    // The screen may have been resized while the view was hidden
+    if (view->lines != LINES || view->cols != COLS) resize_ToggleMenu_View(view);
+    ToggleMenu toggle_menu = view->toggle_menu;
+
+    if (view->state_win != NULL) draw_ToggleMenu_states(view->state_win, view->toggle_menu);
+
+    if (toggle_menu.boxed) {
+        box(view->menu_win,0,0);
+        count_s4c_gui_op(S4C_GUI_WIDGET_MENU, S4C_GUI_OP_BOX);
+    }
+    if (toggle_menu.get_mouse_events) {
+        mmask_t mouse_events_mask = toggle_menu.mouse_events_mask;
+        mousemask(mouse_events_mask, NULL);
+    }
+    if (view->nc_menu != NULL) {
+        post_menu(view->nc_menu);
+    } else {
+        for (int row = 0; row < view->rows; row++) {
+            draw_ToggleMenu_view_row(view, row);
+        }
+    }
+    touchwin(view->menu_win);
+    s4c_gui_stage(view->menu_win, S4C_GUI_WIDGET_MENU);
+    s4c_gui_stage(view->menu_sub, S4C_GUI_WIDGET_MENU);
+    s4c_gui_update(S4C_GUI_WIDGET_MENU);
+    view->damage = s4c_gui_damage;
+    view->shown = true;
+}
+
+static void hide_ToggleMenu_View(ToggleMenu_View* view)
+{
+    if (!view->shown) return;
+    if (view->editing != NULL) {
+        close_TextField(view->editing);
+        view->editing = NULL;
+    }
+    view->searching = false;
+    if (view->nc_menu != NULL) unpost_menu(view->nc_menu);
+    flush_s4c_gui_frame();
+    view->shown = false;
+    notify_ToggleMenu_changes(view->toggle_menu);
+}
+
+static void deinit_ToggleMenu_View(ToggleMenu_View* view)
+{
+    hide_ToggleMenu_View(view);
+    if (view->nc_menu != NULL) {
+        free_menu(view->nc_menu);
+        for (int i = 0; i < view->toggle_menu.num_toggles; i++) {
+            free_item(view->items[i]);
+        }
+        s4c_gui_inner_free(view->items);
+    }
+    delwin(view->menu_sub);
+    delwin(view->menu_win);
+    if (view->state_win != NULL) delwin(view->state_win);
+    if (view->owns_keymap) free_ToggleMenu_Keymap(view->keymap);
+}
+
+/*
+ * Acts on the selected toggle: flips a BOOL_TOGGLE or opens a TEXTFIELD_TOGGLE for input.
+ * MULTI_STATE_TOGGLE ones are cycled only when cycle is true.
+ */
+static void activate_ToggleMenu_view_selected(ToggleMenu_View* view, bool cycle)
+{
+    Toggle *toggle = get_ToggleMenu_view_selected(view);
+    if (toggle == NULL || toggle->locked) return;
+    int toggle_index = toggle - view->toggle_menu.toggles;
+    if (toggle->type == BOOL_TOGGLE) {
+        toggle->state.bool_state = !toggle->state.bool_state;
+        mark_ToggleMenu_dirty(view->toggle_menu, toggle_index);
+    } else if (toggle->type == MULTI_STATE_TOGGLE && cycle) {
+        cycle_toggle_state(toggle);
+        mark_ToggleMenu_dirty(view->toggle_menu, toggle_index);
+    } else if (toggle->type == TEXTFIELD_TOGGLE) {
+        // Input goes to the TextField until Enter is pressed in it
+        view->editing = toggle->state.txt_state;
+        // Opening clears the value, which counts as a change when there was one
+        view->editing->modified = false;
+        open_TextField(view->editing);
+    }
+}
+
+/*
+ * Returns the index of the toggle shown at screen position y, x, in the menu or in the state window.
+ * Returns -1 when there's none.
+ */
+static int hit_ToggleMenu_View(ToggleMenu_View* view, int y, int x)
+{
+    int res = -1;
+    if (wenclose(view->menu_sub, y, x)) {
+        int top = (view->nc_menu != NULL ? top_row(view->nc_menu) : view->toggle_menu.first_visible);
+        res = top + (y - getbegy(view->menu_sub));
+    } else if (view->state_win != NULL && wenclose(view->state_win, y, x)) {
+        // The first row holds the box and label
+        int row = y - getbegy(view->state_win) - 1;
+        if (row < 0 || row >= ToggleMenu_state_rows(view->state_win, view->toggle_menu)) return -1;
+        res = view->toggle_menu.first_visible + row;
+    }
+    return ((res >= 0 && res < view->toggle_menu.num_toggles) ? res : -1);
+}
+
+static void select_ToggleMenu_view_index(ToggleMenu_View* view, int target)
+{
+    if (view->nc_menu != NULL) {
+        set_current_item(view->nc_menu, view->items[target]);
+    } else if (target != view->current) {
+        select_ToggleMenu_view_toggle(view, target);
+    }
+}
+
+/*
+ * Replaces a motion event with the latest one already queued, so a flood of them costs one update.
+ * The first other event found is put back.
+ */
+static void coalesce_ToggleMenu_view_motion(ToggleMenu_View* view, MEVENT* mouse_event)
+{
+    if (mouse_event->bstate != REPORT_MOUSE_POSITION) return;
+    wtimeout(view->menu_win, 0);
+    int c;
+    while ((c = s4c_gui_read_key(view->menu_win)) != ERR) {
+        if (c != KEY_MOUSE) {
+            s4c_gui_unread_key(c);
+            break;
+        }
+        MEVENT next;
+        if (s4c_gui_getmouse(&next) != OK) continue;
+        if (next.bstate != REPORT_MOUSE_POSITION) {
+            s4c_gui_unread_mouse(&next);
+            break;
+        }
+        *mouse_event = next;
+    }
+    wtimeout(view->menu_win, -1);
+}
+
+/*
+ * Maps the event to the toggle below it: motion and presses select it, a click or release also activates it.
+ */
+static void handle_ToggleMenu_view_mouse(ToggleMenu_View* view, MEVENT* mouse_event)
+{
+    int target = hit_ToggleMenu_View(view, mouse_event->y, mouse_event->x);
+    if (target < 0) return;
+    select_ToggleMenu_view_index(view, target);
+    if (mouse_event->bstate & (BUTTON1_CLICKED | BUTTON1_RELEASED)) {
+        activate_ToggleMenu_view_selected(view, true);
+    }
+}
+
+/*
+ * Returns the index of the selected toggle, locked or not, or -1 when there's none.
+ */
+static int get_ToggleMenu_view_selected_index(ToggleMenu_View* view)
+{
+    if (view->nc_menu != NULL) {
+        ITEM* item = current_item(view->nc_menu);
+        return ((item != NULL) ? item_index(item) : -1);
+    }
+    return ((view->current >= 0 && view->current < view->toggle_menu.num_toggles) ? view->current : -1);
+}
+
+/*
+ * Draws the search query over the bottom row of the menu window, or restores the row when not searching.
+ */
+static void draw_ToggleMenu_view_query(ToggleMenu_View* view)
+{
+    WINDOW* win = view->menu_win;
+    int y = getmaxy(win) - 1;
+    int width = getmaxx(win) - 2;
+    if (y < 1 || width < 2) return;
+    mvwhline(win, y, 1, (view->toggle_menu.boxed ? ACS_HLINE : ' '), width);
+    if (!view->searching) return;
+    // Keep the end of the query in view
+    int skip = view->query_len - (width - 1);
+    mvwprintw(win, y, 1, "/%s", view->query + (skip > 0 ? skip : 0));
+    count_s4c_gui_op(S4C_GUI_WIDGET_MENU, S4C_GUI_OP_PRINT);
+}
+
+/*
+ * Selects the first toggle matching the query from the passed one on, if any.
+ */
+static void jump_ToggleMenu_view_search(ToggleMenu_View* view, int from)
+{
+    int n = view->query_len;
+    int target = pick_ToggleMenu_search_match(view->toggle_menu.search, view->match_lo[n], view->match_hi[n], from);
+    if (target >= 0) select_ToggleMenu_view_index(view, target);
+}
+
+static void start_ToggleMenu_view_search(ToggleMenu_View* view)
+{
+    ToggleMenu_SearchIndex search = use_ToggleMenu_SearchIndex(view->toggle_menu);
+    if (search == NULL) return;
+    view->searching = true;
+    view->query_len = 0;
+    view->query[0] = '\0';
+    view->match_lo[0] = 0;
+    view->match_hi[0] = search->count;
+    draw_ToggleMenu_view_query(view);
+}
+
+static void stop_ToggleMenu_view_search(ToggleMenu_View* view)
+{
+    view->searching = false;
+    draw_ToggleMenu_view_query(view);
+}
+
+/*
+ * Applies a key typed while searching: printable ones extend the query and jump to the next match, Tab jumps past it.
+ * Enter and Escape end the search. Returns false when the key ended it and should be handled as usual.
+ */
+static bool handle_ToggleMenu_view_search_key(ToggleMenu_View* view, int c)
+{
+    if (!view->toggle_menu.search->built) {
+        // A toggle was invalidated since the search started, emptying the index
+        stop_ToggleMenu_view_search(view);
+        return false;
+    }
+    int selected = get_ToggleMenu_view_selected_index(view);
+    if (selected < 0) selected = 0;
+    if (c == '\n' || c == 27) {
+        stop_ToggleMenu_view_search(view);
+    } else if (c == KEY_BACKSPACE || c == 127 || c == '\b') {
+        if (view->query_len == 0) {
+            stop_ToggleMenu_view_search(view);
+        } else {
+            // The wider range for the shorter query is kept on the stack
+            view->query[--(view->query_len)] = '\0';
+            draw_ToggleMenu_view_query(view);
+        }
+    } else if (c == '\t') {
+        jump_ToggleMenu_view_search(view, selected + 1);
+    } else if (c >= 0 && c < 128 && isprint(c)) {
+        int n = view->query_len;
+        if (n == TOGGLEMENU_SEARCH_MAX) return true;
+        view->query[n] = c;
+        view->query[n+1] = '\0';
+        view->match_lo[n+1] = view->match_lo[n];
+        view->match_hi[n+1] = view->match_hi[n];
+        narrow_ToggleMenu_SearchIndex(view->toggle_menu.search, view->query, n+1, &(view->match_lo[n+1]), &(view->match_hi[n+1]));
+        view->query_len = n+1;
+        jump_ToggleMenu_view_search(view, selected);
+        draw_ToggleMenu_view_query(view);
+    } else {
+        stop_ToggleMenu_view_search(view);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Runs the action bound to an input key, without flushing.
+ */
+static void run_ToggleMenu_view_action(ToggleMenu_View* view, const ToggleMenu_Keymap_Entry* entry)
+{
+    ToggleMenu toggle_menu = view->toggle_menu;
+    Toggle* toggles = toggle_menu.toggles;
+
+    switch (entry->action) {
+    case TOGGLEMENU_ACTION_DOWN: {
+        move_ToggleMenu_view(view, REQ_DOWN_ITEM);
+    }
+    break;
+    case TOGGLEMENU_ACTION_UP: {
+        move_ToggleMenu_view(view, REQ_UP_ITEM);
+    }
+    break;
+    case TOGGLEMENU_ACTION_PAGE_DOWN: {
+        move_ToggleMenu_view(view, REQ_SCR_DPAGE);
+    }
+    break;
+    case TOGGLEMENU_ACTION_PAGE_UP: {
+        move_ToggleMenu_view(view, REQ_SCR_UPAGE);
+    }
+    break;
+    case TOGGLEMENU_ACTION_FIRST: {
+        move_ToggleMenu_view(view, REQ_FIRST_ITEM);
+    }
+    break;
+    case TOGGLEMENU_ACTION_LAST: {
+        move_ToggleMenu_view(view, REQ_LAST_ITEM);
+    }
+    break;
+    case TOGGLEMENU_ACTION_CYCLE: {
+        // Cycle through states for selected item
+        Toggle *toggle = get_ToggleMenu_view_selected(view);
+        if (toggle && toggle->type == MULTI_STATE_TOGGLE && !toggle->locked) {
+            cycle_toggle_state(toggle);
+            mark_ToggleMenu_dirty(view->toggle_menu, toggle - toggles);
+        }
+    }
+    break;
+    case TOGGLEMENU_ACTION_ACTIVATE: {
+        activate_ToggleMenu_view_selected(view, false);
+    }
+    break;
+    case TOGGLEMENU_ACTION_MOUSE: {
+        MEVENT mouse_event;
+        if (s4c_gui_getmouse(&mouse_event) == OK) {
+            coalesce_ToggleMenu_view_motion(view, &mouse_event);
+            handle_ToggleMenu_view_mouse(view, &mouse_event);
+            if (toggle_menu.mouse_handler != NULL && wenclose(view->menu_win, mouse_event.y, mouse_event.x) == TRUE) {
+                toggle_menu.mouse_handler(view->toggle_menu, &mouse_event);
             }
         } else {
-            if (*length < max_length) {
-                if (*length == 0) {
-                    //Clear and rebox win on first char entered
-                    wclear(win);
-                    box(win, 0, 0);
-                    wmove(win, 1, input_start_x);
+            show_s4c_gui_notice(LINES, 0, "Failed getmouse().", TOGGLEMENU_NOTICE_MSECS);
+        }
+    }
+    break;
+    case TOGGLEMENU_ACTION_SEARCH: {
+        start_ToggleMenu_view_search(view);
+    }
+    break;
+    case TOGGLEMENU_ACTION_USER: {
+        entry->handler(view->toggle_menu, get_ToggleMenu_view_selected_index(view), entry->arg);
+    }
+    break;
+    default: {
+        // TOGGLEMENU_ACTION_QUIT is handled by the caller
+    }
+    break;
+    }
+}
+
+/*
+ * Fits the view windows to the resized screen, keeping the MENU, its items, the keymap and the search state.
+ * Only the viewport depends on the window size, so only it is recomputed. The next flush repaints everything once.
+ */
+static void resize_ToggleMenu_View(ToggleMenu_View* view)
+{
+    ToggleMenu* toggle_menu = &(view->toggle_menu);
+    view->lines = LINES;
+    view->cols = COLS;
+    uncover_s4c_gui_screen();
+    view->damage = s4c_gui_damage;
+    if (toggle_menu->resize_handler != NULL) toggle_menu->resize_handler(toggle_menu);
+    if (view->state_win != NULL) {
+        fit_s4c_gui_win(view->state_win, toggle_menu->statewin_height, toggle_menu->statewin_width, toggle_menu->statewin_start_y, toggle_menu->statewin_start_x);
+    }
+
+    // A derived window can't follow its parent around: make it again for the new size
+    int current_index = get_ToggleMenu_view_selected_index(view);
+    if (view->nc_menu != NULL && view->shown) unpost_menu(view->nc_menu);
+    delwin(view->menu_sub);
+    fit_s4c_gui_win(view->menu_win, toggle_menu->height, toggle_menu->width, toggle_menu->start_y, toggle_menu->start_x);
+    view->rows = getmaxy(view->menu_win) - 2;
+    if (view->rows < 0) view->rows = 0;
+    new_ToggleMenu_View_sub(view);
+    werase(view->menu_win);
+    count_s4c_gui_op(S4C_GUI_WIDGET_MENU, S4C_GUI_OP_CLEAR);
+    if (toggle_menu->boxed) {
+        box(view->menu_win, 0, 0);
+        count_s4c_gui_op(S4C_GUI_WIDGET_MENU, S4C_GUI_OP_BOX);
+    }
+
+    if (view->nc_menu != NULL) {
+        // Keep the initial format while it fits. Setting it selects the first item again
+        int rows = (view->rows < view->menu_rows ? view->rows : view->menu_rows);
+        set_menu_format(view->nc_menu, (rows > 0 ? rows : 1), 1);
+        if (current_index >= 0) set_current_item(view->nc_menu, view->items[current_index]);
+        if (view->shown) post_menu(view->nc_menu);
+    } else {
+        // Keep the selection in view
+        int first = toggle_menu->first_visible;
+        if (view->current >= first + view->rows) first = view->current - view->rows + 1;
+        if (first > view->current) first = view->current;
+        toggle_menu->first_visible = first;
+        if (view->shown) {
+            for (int row = 0; row < view->rows; row++) {
+                draw_ToggleMenu_view_row(view, row);
+            }
+        }
+    }
+    if (view->searching) draw_ToggleMenu_view_query(view);
+    touchwin(view->menu_win);
+    mark_ToggleMenu_all_dirty(*toggle_menu);
+}
+
+/*
+ * Flushes the changed rows with a single doupdate().
+ */
+static void flush_ToggleMenu_View(ToggleMenu_View* view)
+{
+    if (view->lines != LINES || view->cols != COLS) {
+        // The screen was resized while the KEY_RESIZE went to an open TextField
+        resize_ToggleMenu_View(view);
+    }
+    if (view->damage != s4c_gui_damage) {
+        // A notice over our windows went away
+        touchwin(view->menu_win);
+        mark_ToggleMenu_all_dirty(view->toggle_menu);
+        view->damage = s4c_gui_damage;
+    }
+    s4c_gui_stage(view->menu_win, S4C_GUI_WIDGET_MENU);
+    s4c_gui_stage(view->menu_sub, S4C_GUI_WIDGET_MENU);
+    if (view->state_win != NULL) draw_ToggleMenu_dirty_states(view->state_win, view->toggle_menu);
+    s4c_gui_update(S4C_GUI_WIDGET_MENU);
+    // Once per input event, after the changes are staged for the screen
+    notify_ToggleMenu_changes(view->toggle_menu);
+}
+
+/*
+ * Handles the input that is ready, waiting up to timeout milliseconds for the first key: 0 doesn't wait, -1 blocks.
+ * The screen is flushed once per input event, at most S4C_GUI_MAX_FPS times per second.
+ */
+static S4C_Gui_Step step_ToggleMenu_View(ToggleMenu_View* view, int timeout)
+{
+    ToggleMenu_UpdateQueue updates = view->toggle_menu.updates;
+    for (;;) {
+        if (updates != NULL) {
+            // Values posted by other threads: the TextField being edited keeps what's typed
+            if (drain_ToggleMenu_updates(view->toggle_menu, view->editing) > 0) {
+                flush_ToggleMenu_View(view);
+                if (view->editing != NULL) {
+                    // Keep it above the repainted rows, with the cursor
+                    WINDOW* win = view->editing->win;
+                    touchwin(win);
+                    s4c_gui_wrefresh(win, S4C_GUI_WIDGET_TEXTFIELD);
                 }
-                // Echo the character
-                waddch(win, ch);
-                wrefresh(win);
-                // Add it to the buffer
-                buffer[(*length)++] = ch;
-            } else {
-                // Buffer is full
-                if (txt_field->handler != NULL) {
-                    txt_field->handler(txt_field);
+            }
+            WINDOW* win = (view->editing != NULL ? view->editing->win : view->menu_win);
+            if (timeout != 0 && wait_s4c_gui_wake(win, get_ToggleMenu_UpdateQueue_fd(updates), &timeout)) continue;
+        }
+        if (view->editing != NULL) {
+            S4C_Gui_Step step = step_TextField(view->editing, timeout);
+            if (step != S4C_GUI_STEP_DONE) {
+                if (view->lines != LINES || view->cols != COLS) {
+                    // The TextField took the KEY_RESIZE: lay the view out again below it
+                    flush_ToggleMenu_View(view);
+                    WINDOW* win = view->editing->win;
+                    touchwin(win);
+                    s4c_gui_wrefresh(win, S4C_GUI_WIDGET_TEXTFIELD);
                 }
+                return step;
+            }
+            close_TextField(view->editing);
+            bool changed = view->editing->modified;
+            view->editing = NULL;
+            // The value column may have changed width
+            int edited = get_ToggleMenu_view_selected_index(view);
+            if (edited >= 0 && changed) mark_ToggleMenu_dirty(view->toggle_menu, edited);
+            // The TextField window may have covered our windows
+            touchwin(view->menu_win);
+            mark_ToggleMenu_all_dirty(view->toggle_menu);
+            flush_ToggleMenu_View(view);
+            // Only handle what's already pending from now on
+            timeout = 0;
+        }
+        int c = s4c_gui_wgetch(view->menu_win, &timeout);
+        if (c == S4C_GUI_KEY_TIMER) {
+            if (view->damage != s4c_gui_damage) flush_ToggleMenu_View(view);
+            continue;
+        }
+        if (c == ERR) {
+            // A blocking read only fails when input is gone
+            return (timeout < 0 ? S4C_GUI_STEP_EOF : S4C_GUI_STEP_CONTINUE);
+        }
+        if (c == KEY_RESIZE) {
+            // Not a bindable key: a burst of them is handled as one
+            drain_s4c_gui_resizes(view->menu_win);
+            resize_ToggleMenu_View(view);
+            flush_ToggleMenu_View(view);
+            timeout = 0;
+            continue;
+        }
+        if (view->searching && handle_ToggleMenu_view_search_key(view, c)) {
+            flush_ToggleMenu_View(view);
+            timeout = 0;
+            continue;
+        }
+        if (view->keymap == NULL) {
+            // The keymap couldn't be allocated: only let the user out
+            if (c == view->toggle_menu.quit_key) {
+                flush_s4c_gui_frame();
+                notify_ToggleMenu_changes(view->toggle_menu);
+                return S4C_GUI_STEP_DONE;
             }
+            timeout = 0;
+            continue;
+        }
+        const ToggleMenu_Keymap_Entry* entry = lookup_ToggleMenu_Keymap(view->keymap, &(view->chord), c);
+        if (entry == NULL) {
+            // Unbound, or waiting for the rest of a chord
+            timeout = 0;
+            continue;
         }
+        if (entry->action == TOGGLEMENU_ACTION_QUIT) {
+            flush_s4c_gui_frame();
+            notify_ToggleMenu_changes(view->toggle_menu);
+            return S4C_GUI_STEP_DONE;
+        }
+        run_ToggleMenu_view_action(view, entry);
+        if (view->editing == NULL) flush_ToggleMenu_View(view);
+        timeout = 0;
     }
 }
 
-void use_clean_TextField(TextField txt_field)
+/*
+ * Handles input for a shown view, until the quit key is pressed.
+ */
+static void run_ToggleMenu_View(ToggleMenu_View* view)
 {
-    assert(txt_field!=NULL);
-    clear_TextField(txt_field);
+    // Main loop
+    s4c_gui_stepping++;
+    while (step_ToggleMenu_View(view, -1) == S4C_GUI_STEP_CONTINUE);
+    s4c_gui_stepping--;
+}
 
-    draw_TextField(txt_field);
+void handle_ToggleMenu(ToggleMenu toggle_menu)
+{
+    ToggleMenu_View view = {0};
+    init_ToggleMenu_View(&view, toggle_menu);
+    show_ToggleMenu_View(&view);
+    run_ToggleMenu_View(&view);
 
-    get_userText(txt_field);
-    wclear(txt_field->win);
-    wrefresh(txt_field->win);
+    // Clean up
+    deinit_ToggleMenu_View(&view);
 }
-// }
-// TEXT_FIELD_H_
 
+struct ToggleMenu_Session_s {
+    ToggleMenu_View view;
+};
 
-#ifndef TOGGLE_H_
-#error "This should not happen. TOGGLE_H_ is defined in s4c_gui.h"
-#include "toggle.h"
-#endif // TOGGLE_H_
-
-static const int TOGGLE_MENU_DEFAULT_QUIT_KEY = KEY_F(1);
+/*
+ * Returns a session keeping the curses objects for the passed ToggleMenu alive between calls to handle_ToggleMenu_Session().
+ * Free it with free_ToggleMenu_Session() before calling free_ToggleMenu().
+ */
+ToggleMenu_Session new_ToggleMenu_Session(ToggleMenu toggle_menu)
+{
+    ToggleMenu_Session res = s4c_gui_inner_calloc(1, sizeof(struct ToggleMenu_Session_s));
+    if (res == NULL) return NULL;
+    init_ToggleMenu_View(&(res->view), toggle_menu);
+    return res;
+}
 
-static void cycle_toggle_state(Toggle *toggle)
+/*
+ * Shows the session's windows, rebuilding only the items of the toggles passed to invalidate_ToggleMenu_toggle()
+ * since last time.
+ */
+void open_ToggleMenu_Session(ToggleMenu_Session session)
 {
-    toggle->state.ts_state.current_state = (toggle->state.ts_state.current_state + 1) % toggle->state.ts_state.num_states;
+    assert(session!=NULL);
+    show_ToggleMenu_View(&(session->view));
 }
 
-ToggleMenu new_ToggleMenu_(Toggle* toggles, int num_toggles, ToggleMenu_Conf conf)
+/*
+ * Opens the session if needed, then handles input until the quit key is pressed and closes it.
+ */
+void handle_ToggleMenu_Session(ToggleMenu_Session session)
 {
-    size_t widest_label_size = 0;
-    for (size_t i=0; i < num_toggles; i++) {
-        size_t curr_size = strlen(toggles[i].label);
-        if (curr_size > widest_label_size) widest_label_size = curr_size;
-    }
-    return (ToggleMenu) {
-        .toggles = toggles,
-        .num_toggles = num_toggles,
-        .height = num_toggles+2,
-        .width = widest_label_size+2,
-        .start_x = conf.start_x,
-        .start_y = conf.start_y,
-        .boxed = conf.boxed,
-        .quit_key = ((conf.quit_key < 0) ? TOGGLE_MENU_DEFAULT_QUIT_KEY : conf.quit_key),
-        .statewin_height = conf.statewin_height,
-        .statewin_width = conf.statewin_width,
-        .statewin_start_x = conf.statewin_start_x,
-        .statewin_start_y = conf.statewin_start_y,
-        .statewin_boxed = conf.statewin_boxed,
-        .statewin_label = conf.statewin_label,
-        .key_up = conf.key_up,
-        .key_right = conf.key_right,
-        .key_down = conf.key_down,
-        .key_left = conf.key_left,
-        .get_mouse_events = conf.get_mouse_events,
-        .mouse_handler = conf.mouse_handler,
-        .mouse_events_mask = conf.mouse_events_mask,
-    };
+    assert(session!=NULL);
+    show_ToggleMenu_View(&(session->view));
+    run_ToggleMenu_View(&(session->view));
+    hide_ToggleMenu_View(&(session->view));
 }
 
-void default_ToggleMenu_mousehandler__(ToggleMenu toggle_menu, MEVENT* mouse_event)
+/*
+ * Opens the session if needed, then handles the input that is ready and returns.
+ * Waits up to timeout milliseconds for the first key: 0 doesn't wait, -1 blocks.
+ * Meant to be called when get_s4c_gui_input_fd() is readable, from the caller's own event loop.
+ * Returns S4C_GUI_STEP_DONE when the quit key was pressed: the session stays open until close_ToggleMenu_Session().
+ */
+S4C_Gui_Step step_ToggleMenu_Session(ToggleMenu_Session session, int timeout)
 {
-    printw("[DEBUG] %s():    Got mouse event at {x: %i, y: %i, z: %i}\n", __func__, mouse_event->x, mouse_event->y, mouse_event->z);
-    printw("[DEBUG] %s():    Info on menu: {\n", __func__);
-    printw("[DEBUG]" ToggleMenu_Fmt "\n", ToggleMenu_Arg(toggle_menu));
-    printw("[DEBUG] }\n");
-    refresh();
-    napms(2000);
+    assert(session!=NULL);
+    show_ToggleMenu_View(&(session->view));
+    s4c_gui_stepping++;
+    S4C_Gui_Step res = step_ToggleMenu_View(&(session->view), timeout);
+    s4c_gui_stepping--;
+    return res;
 }
 
-static const ToggleMenu_Conf TOGGLE_MENU_DEFAULT_CONF = {
-    .start_x = 0,
-    .start_y = 0,
-    .boxed = true,
-    .quit_key = TOGGLE_MENU_DEFAULT_QUIT_KEY,
-    .key_up = KEY_UP,
-    .key_right = KEY_RIGHT,
-    .key_down = KEY_DOWN,
-    .key_left = KEY_LEFT,
-};
+void close_ToggleMenu_Session(ToggleMenu_Session session)
+{
+    assert(session!=NULL);
+    hide_ToggleMenu_View(&(session->view));
+}
 
-ToggleMenu new_ToggleMenu(Toggle* toggles, int num_toggles)
+void free_ToggleMenu_Session(ToggleMenu_Session session)
 {
-    return new_ToggleMenu_(toggles, num_toggles, TOGGLE_MENU_DEFAULT_CONF);
+    if (session == NULL) return;
+    deinit_ToggleMenu_View(&(session->view));
+    s4c_gui_inner_free(session);
 }
 
-ToggleMenu new_ToggleMenu_with_mouse_mask(Toggle* toggles, int num_toggles, ToggleMenu_MouseEvent_Handler* mouse_events_handler, mmask_t mouse_events_mask)
+/*
+ * ToggleMenu state file layout, all integers little endian:
+ *   header: "S4CT", u32 version, u32 num_toggles, u32 text_size
+ *   one record per toggle: u8 type, u8 flags, u16 zero, u32 value
+ *     value is the state index of a MULTI_STATE_TOGGLE and the value length of a TEXTFIELD_TOGGLE
+ *   text_size bytes: the TextField values in toggle order, not terminated
+ * Labels aren't saved: a file only applies to a menu built with the same toggles.
+ */
+#define TOGGLEMENU_STATE_MAGIC "S4CT"
+#define TOGGLEMENU_STATE_HEADER_SIZE 16
+#define TOGGLEMENU_STATE_RECORD_SIZE 8
+#define TOGGLEMENU_STATE_LOCKED 0x1
+#define TOGGLEMENU_STATE_ON 0x2 // bool_state of a BOOL_TOGGLE
+
+static void put_ToggleMenu_state_u32(unsigned char* buf, uint32_t val)
 {
-    ToggleMenu res = new_ToggleMenu_(toggles, num_toggles, TOGGLE_MENU_DEFAULT_CONF);
-    res.get_mouse_events = true;
-    res.mouse_handler = mouse_events_handler;
-    res.mouse_events_mask = mouse_events_mask;
-    return res;
+    buf[0] = val & 0xff;
+    buf[1] = (val >> 8) & 0xff;
+    buf[2] = (val >> 16) & 0xff;
+    buf[3] = (val >> 24) & 0xff;
 }
 
-ToggleMenu new_ToggleMenu_with_mouse(Toggle* toggles, int num_toggles, ToggleMenu_MouseEvent_Handler* mouse_events_handler)
+static uint32_t get_ToggleMenu_state_u32(const unsigned char* buf)
 {
-    return new_ToggleMenu_with_mouse_mask(toggles, num_toggles, mouse_events_handler, TOGGLEMENU_DEFAULT_MOUSEEVENTS_MASK);
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t) buf[3] << 24);
 }
 
-void free_ToggleMenu(ToggleMenu toggle_menu)
+/*
+ * Writes the state of every toggle to path, replacing it: bools, multi state indexes, TextField values and locks.
+ * The state goes to path with ".tmp" appended first, renamed over path once complete, so a failed save keeps the old file.
+ * Returns false when the file couldn't be written.
+ */
+bool save_ToggleMenu_state(ToggleMenu toggle_menu, const char* path)
 {
-    for (size_t i=0; i<toggle_menu.num_toggles; i++) {
-        switch (toggle_menu.toggles[i].type) {
-        case BOOL_TOGGLE:
+    assert(path!=NULL);
+    Toggle* toggles = toggle_menu.toggles;
+    int num_toggles = toggle_menu.num_toggles;
+    uint32_t text_size = 0;
+    for (int i = 0; i < num_toggles; i++) {
+        if (toggles[i].type == TEXTFIELD_TOGGLE) text_size += get_TextField_len(toggles[i].state.txt_state);
+    }
+    size_t path_len = strlen(path);
+    char* tmp_path = s4c_gui_inner_calloc(path_len + sizeof(".tmp"), sizeof(char));
+    if (tmp_path == NULL) return false;
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", sizeof(".tmp"));
+    FILE* file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        s4c_gui_inner_free(tmp_path);
+        return false;
+    }
+
+    unsigned char header[TOGGLEMENU_STATE_HEADER_SIZE];
+    memcpy(header, TOGGLEMENU_STATE_MAGIC, 4);
+    put_ToggleMenu_state_u32(header + 4, TOGGLEMENU_STATE_VERSION);
+    put_ToggleMenu_state_u32(header + 8, num_toggles);
+    put_ToggleMenu_state_u32(header + 12, text_size);
+    bool res = (fwrite(header, sizeof(header), 1, file) == 1);
+    for (int i = 0; res && i < num_toggles; i++) {
+        unsigned char record[TOGGLEMENU_STATE_RECORD_SIZE] = {0};
+        record[0] = toggles[i].type;
+        record[1] = (toggles[i].locked ? TOGGLEMENU_STATE_LOCKED : 0);
+        uint32_t value = 0;
+        switch (toggles[i].type) {
+        case BOOL_TOGGLE: {
+            if (toggles[i].state.bool_state) record[1] |= TOGGLEMENU_STATE_ON;
+        }
+        break;
         case MULTI_STATE_TOGGLE: {
-            break;
+            value = toggles[i].state.ts_state.current_state;
         }
+        break;
         case TEXTFIELD_TOGGLE: {
-            free_TextField(toggle_menu.toggles[i].state.txt_state);
-            break;
-        }
-        default: {
-            //Unexpected
-            assert(false);
-            break;
+            value = get_TextField_len(toggles[i].state.txt_state);
         }
+        break;
         }
+        put_ToggleMenu_state_u32(record + 4, value);
+        res = (fwrite(record, sizeof(record), 1, file) == 1);
+    }
+    for (int i = 0; res && i < num_toggles; i++) {
+        if (toggles[i].type != TEXTFIELD_TOGGLE) continue;
+        TextField txt = toggles[i].state.txt_state;
+        size_t len = get_TextField_len(txt);
+        if (len > 0) res = (fwrite(get_TextField_value(txt), len, 1, file) == 1);
     }
+#ifndef _WIN32
+    // The data must reach the disk before the rename does
+    if (res && (fflush(file) != 0 || fsync(fileno(file)) != 0)) res = false;
+#endif // _WIN32
+    if (fclose(file) != 0) res = false;
+#ifdef _WIN32
+    // rename() doesn't replace an existing file there
+    if (res) remove(path);
+#endif // _WIN32
+    if (res && rename(tmp_path, path) != 0) res = false;
+    if (!res) remove(tmp_path);
+    s4c_gui_inner_free(tmp_path);
+    return res;
 }
 
-void draw_ToggleMenu_states(WINDOW *win, ToggleMenu toggle_menu)
+/*
+ * Applies a state saved by save_ToggleMenu_state() from memory, copying TextField values into their buffers.
+ * The whole of data is checked first: nothing is changed when it's malformed, of another version, or doesn't
+ * match the toggles. Changed toggles are marked dirty.
+ */
+bool apply_ToggleMenu_state(ToggleMenu toggle_menu, const void* data, size_t size)
 {
-
+    assert(data!=NULL || size == 0);
+    const unsigned char* buf = data;
     Toggle* toggles = toggle_menu.toggles;
     int num_toggles = toggle_menu.num_toggles;
-    // Clear the window
-    wclear(win);
+    if (size < TOGGLEMENU_STATE_HEADER_SIZE || memcmp(buf, TOGGLEMENU_STATE_MAGIC, 4) != 0) return false;
+    if (get_ToggleMenu_state_u32(buf + 4) != TOGGLEMENU_STATE_VERSION) return false;
+    if (get_ToggleMenu_state_u32(buf + 8) != (uint32_t) num_toggles) return false;
+    size_t text_size = get_ToggleMenu_state_u32(buf + 12);
+    const unsigned char* records = buf + TOGGLEMENU_STATE_HEADER_SIZE;
+    const char* text = (const char*) records + (size_t) num_toggles * TOGGLEMENU_STATE_RECORD_SIZE;
+    if (size != (size_t) ((const unsigned char*) text - buf) + text_size) return false;
 
-    if (toggle_menu.statewin_boxed) box(win, 0, 0);
-    if (toggle_menu.statewin_label != NULL) mvwprintw(win, 0, 1, "%s", toggle_menu.statewin_label);
+    size_t text_used = 0;
+    for (int i = 0; i < num_toggles; i++) {
+        const unsigned char* record = records + (size_t) i * TOGGLEMENU_STATE_RECORD_SIZE;
+        uint32_t value = get_ToggleMenu_state_u32(record + 4);
+        if (record[0] != toggles[i].type) return false;
+        if (toggles[i].type == MULTI_STATE_TOGGLE && value >= (uint32_t) toggles[i].state.ts_state.num_states) return false;
+        if (toggles[i].type == TEXTFIELD_TOGGLE) {
+            if (value > (uint32_t) toggles[i].state.txt_state->max_length) return false;
+            text_used += value;
+        }
+    }
+    if (text_used != text_size) return false;
 
-    // Print toggle states
     for (int i = 0; i < num_toggles; i++) {
-        // Print toggle label
-        mvwprintw(win, i + 1, 1, "%s:", toggles[i].label);
-
-        // Print toggle state
-        if (toggles[i].type == BOOL_TOGGLE) {
-            mvwprintw(win, i + 1, 20, "[%s]", toggles[i].state.bool_state ? "ON" : "OFF");
-        } else if (toggles[i].type == MULTI_STATE_TOGGLE) {
-            if (toggles[i].multistate_formatter != NULL) {
-                mvwprintw(win, i + 1, 20, "[%s]", toggles[i].multistate_formatter(toggles[i].state.ts_state.current_state));
-            } else {
-                mvwprintw(win, i + 1, 20, "[%d/%d]", toggles[i].state.ts_state.current_state, toggles[i].state.ts_state.num_states);
+        const unsigned char* record = records + (size_t) i * TOGGLEMENU_STATE_RECORD_SIZE;
+        uint32_t value = get_ToggleMenu_state_u32(record + 4);
+        bool locked = (record[1] & TOGGLEMENU_STATE_LOCKED);
+        bool changed = (toggles[i].locked != locked);
+        toggles[i].locked = locked;
+        if (changed) invalidate_ToggleMenu_toggle(toggle_menu, i);
+        switch (toggles[i].type) {
+        case BOOL_TOGGLE: {
+            bool on = (record[1] & TOGGLEMENU_STATE_ON);
+            changed = changed || (toggles[i].state.bool_state != on);
+            toggles[i].state.bool_state = on;
+        }
+        break;
+        case MULTI_STATE_TOGGLE: {
+            changed = changed || ((uint32_t) toggles[i].state.ts_state.current_state != value);
+            toggles[i].state.ts_state.current_state = value;
+        }
+        break;
+        case TEXTFIELD_TOGGLE: {
+            TextField txt = toggles[i].state.txt_state;
+            if (txt->length != value || memcmp(get_TextField_value(txt), text, value) != 0) {
+                set_TextField_value(txt, text, value);
+                changed = true;
             }
-        } else if (toggles[i].type == TEXTFIELD_TOGGLE) {
-            mvwprintw(win, i + 1, 20, "%s", get_TextField_value(toggles[i].state.txt_state));
+            text += value;
         }
-
-        // Print lock indicator
-        if (toggles[i].locked) {
-            mvwprintw(win, i + 1, 30, "(LOCKED)");
+        break;
         }
+        if (changed) mark_ToggleMenu_dirty(toggle_menu, i);
     }
-
-    wrefresh(win);
+    return true;
 }
 
-void handle_ToggleMenu(ToggleMenu toggle_menu)
+/*
+ * Applies the state saved to path by save_ToggleMenu_state(), mapping the file instead of reading it in.
+ * Returns false, changing nothing, when the file can't be read or doesn't match the toggles.
+ */
+bool restore_ToggleMenu_state(ToggleMenu toggle_menu, const char* path)
 {
-    bool try_display_state = false;
-    WINDOW* state_win = NULL;
-    if (toggle_menu.statewin_width > 0 && toggle_menu.statewin_height > 0) {
-        try_display_state = true;
-        // Create a window for toggle states
-        state_win = newwin(toggle_menu.statewin_height, toggle_menu.statewin_width, toggle_menu.statewin_start_y, toggle_menu.statewin_start_x);
-        if (toggle_menu.statewin_boxed) box(state_win, 0, 0);
-        if (toggle_menu.statewin_label != NULL) mvwprintw(state_win, 0, 1, "%s", toggle_menu.statewin_label);
-        wrefresh(state_win);
+    assert(path!=NULL);
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < TOGGLEMENU_STATE_HEADER_SIZE) {
+        close(fd);
+        return false;
     }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid without the fd
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    bool res = apply_ToggleMenu_state(toggle_menu, data, st.st_size);
+    munmap(data, st.st_size);
+    return res;
+#else
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+    bool res = false;
+    long size = (fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1);
+    void* data = (size >= TOGGLEMENU_STATE_HEADER_SIZE ? s4c_gui_inner_malloc(size) : NULL);
+    if (data != NULL) {
+        rewind(file);
+        if (fread(data, size, 1, file) == 1) res = apply_ToggleMenu_state(toggle_menu, data, size);
+        s4c_gui_inner_free(data);
+    }
+    fclose(file);
+    return res;
+#endif // _WIN32
+}
 
-    Toggle* toggles = toggle_menu.toggles;
-    int num_toggles = toggle_menu.num_toggles;
+#define TOGGLEMENU_LOAD_CHUNK 256 // Toggles per chunk while their count isn't known yet
 
-    // Create MENU for toggles
-    ITEM **toggle_items = (ITEM **)calloc(num_toggles + 1, sizeof(ITEM *));
-    MENU *nc_menu;
-    for (int i = 0; i < num_toggles; i++) {
-        toggle_items[i] = new_item(toggles[i].label, "");
-        if (toggles[i].type == MULTI_STATE_TOGGLE && !toggles[i].locked) {
-            // Allow cycling through states for MULTI_STATE_TOGGLE toggles
-            set_item_userptr(toggle_items[i], &toggles[i]);
-        }
-        if (toggles[i].type == BOOL_TOGGLE && !toggles[i].locked) {
-            // Allow switching on bool toggle
-            set_item_userptr(toggle_items[i], &toggles[i]);
-        }
-        if (toggles[i].type == TEXTFIELD_TOGGLE && !toggles[i].locked) {
-            // Allow changing textfield toggle
-            set_item_userptr(toggle_items[i], &toggles[i]);
+/*
+ * Toggles parsed so far. Chunks come from the arena too, so loading never calls malloc on its own.
+ */
+typedef struct ToggleMenu_Load_Chunk {
+    struct ToggleMenu_Load_Chunk* next;
+    int count;
+    Toggle toggles[TOGGLEMENU_LOAD_CHUNK];
+} ToggleMenu_Load_Chunk;
+
+/*
+ * Returns the next whitespace separated word of the line at *cursor, NUL terminated in place, or NULL at its end.
+ */
+static char* next_ToggleMenu_load_word(char** cursor)
+{
+    char* c = *cursor;
+    while (*c == ' ' || *c == '\t') c++;
+    if (*c == '\0') return NULL;
+    char* res = c;
+    while (*c != '\0' && *c != ' ' && *c != '\t') c++;
+    if (*c != '\0') *c++ = '\0';
+    *cursor = c;
+    return res;
+}
+
+/*
+ * Parses a non negative int taking the whole of word, up to max. Returns -1 when it's not one.
+ */
+static long parse_ToggleMenu_load_int(const char* word, long max)
+{
+    if (word == NULL || !isdigit((unsigned char) *word)) return -1;
+    char* end = NULL;
+    long res = strtol(word, &end, 10);
+    if (*end != '\0' || res > max) return -1;
+    return res;
+}
+
+/*
+ * Parses one toggle line into toggle, allocating its label and TextField from the arena.
+ * Returns false when the line is malformed.
+ */
+static bool parse_ToggleMenu_load_line(char* line, Toggle* toggle, S4C_Gui_Arena* arena, int txt_height, int txt_width, int txt_start_x, int txt_start_y)
+{
+    char* cursor = line;
+    char* type = next_ToggleMenu_load_word(&cursor);
+    char* state = next_ToggleMenu_load_word(&cursor);
+    if (type == NULL || state == NULL) return false;
+    // An optional lock flag comes before the label, which is the rest of the line
+    char* label = cursor;
+    while (*label == ' ' || *label == '\t') label++;
+    bool locked = (strncmp(label, "locked", 6) == 0 && (label[6] == ' ' || label[6] == '\t'));
+    if (locked) label += 6;
+    while (*label == ' ' || *label == '\t') label++;
+    if (*label == '\0') return false;
+
+    memset(toggle, 0, sizeof(Toggle));
+    toggle->locked = locked;
+    if (strcmp(type, "bool") == 0) {
+        toggle->type = BOOL_TOGGLE;
+        if (strcmp(state, "on") == 0) {
+            toggle->state.bool_state = true;
+        } else if (strcmp(state, "off") != 0) {
+            return false;
         }
+    } else if (strcmp(type, "multi") == 0) {
+        // current/num_states
+        char* slash = strchr(state, '/');
+        if (slash == NULL) return false;
+        *slash = '\0';
+        long current = parse_ToggleMenu_load_int(state, INT_MAX);
+        long num_states = parse_ToggleMenu_load_int(slash + 1, INT_MAX);
+        if (current < 0 || num_states < 1 || current >= num_states) return false;
+        toggle->type = MULTI_STATE_TOGGLE;
+        toggle->state.ts_state.current_state = current;
+        toggle->state.ts_state.num_states = num_states;
+    } else if (strcmp(type, "text") == 0) {
+        long max_size = parse_ToggleMenu_load_int(state, INT_MAX - 1);
+        if (max_size < 1) return false;
+        toggle->type = TEXTFIELD_TOGGLE;
+        toggle->state.txt_state = new_TextField_with_allocator(&warn_TextField, default_linters, TEXTFIELD_DEFAULT_LINTERS_TOT, default_linter_args, max_size, txt_height, txt_width, txt_start_x, txt_start_y, NULL, get_S4C_Gui_Arena_allocator(arena));
+        if (toggle->state.txt_state == NULL) return false;
+    } else {
+        return false;
     }
-    toggle_items[num_toggles] = NULL;
-    nc_menu = new_menu(toggle_items);
-
-    if (try_display_state) draw_ToggleMenu_states(state_win, toggle_menu);
 
-    // Create a window for the MENU
-    WINDOW *menu_win = newwin(toggle_menu.height, toggle_menu.width, toggle_menu.start_y, toggle_menu.start_x); //LINES/2, COLS / 2, 0, 0);
-    keypad(menu_win, TRUE);
-    set_menu_win(nc_menu, menu_win);
-    set_menu_sub(nc_menu, derwin(menu_win, toggle_menu.height -1, toggle_menu.width -2, toggle_menu.start_y +1, toggle_menu.start_x+1)); //LINES/2) - 2, COLS / 2 - 2, 1, 1));
-    set_menu_mark(nc_menu, "");
-    if (toggle_menu.boxed) box(menu_win,0,0);
-    if (toggle_menu.get_mouse_events) {
-        mmask_t mouse_events_mask = toggle_menu.mouse_events_mask;
-        mousemask(mouse_events_mask, NULL);
+    size_t label_len = strlen(label);
+    toggle->label = alloc_S4C_Gui_Arena(arena, label_len + 1);
+    if (toggle->label == NULL) {
+        if (toggle->type == TEXTFIELD_TOGGLE) free_TextField(toggle->state.txt_state);
+        return false;
     }
-    post_menu(nc_menu);
-    wrefresh(menu_win);
+    memcpy(toggle->label, label, label_len + 1);
+    return true;
+}
 
-    // Main loop
-    int c;
-    while ((c = wgetch(menu_win)) != toggle_menu.quit_key) {
-        if ( c == toggle_menu.key_down) {
-            int res = menu_driver(nc_menu, REQ_DOWN_ITEM);
-            if (res == E_REQUEST_DENIED) {
-                res = menu_driver(nc_menu, REQ_FIRST_ITEM);
-            }
-        } else if ( c == toggle_menu.key_up) {
-            int res = menu_driver(nc_menu, REQ_UP_ITEM);
-            if (res == E_REQUEST_DENIED) {
-                res = menu_driver(nc_menu, REQ_LAST_ITEM);
-            }
-        } else if ( c == toggle_menu.key_right) {
-            // Cycle through states for selected item
-            if (current_item(nc_menu)) {
-                Toggle *toggle = (Toggle *)item_userptr(current_item(nc_menu));
-                if (toggle && toggle->type == MULTI_STATE_TOGGLE && !toggle->locked) {
-                    cycle_toggle_state(toggle);
-                    if (try_display_state) draw_ToggleMenu_states(state_win, toggle_menu);
-                }
-            }
-        } else if ( c == toggle_menu.key_left) {
-            // Cycle through states for selected item
-            if (current_item(nc_menu)) {
-                Toggle *toggle = (Toggle *)item_userptr(current_item(nc_menu));
-                if (toggle && toggle->type == MULTI_STATE_TOGGLE && !toggle->locked) {
-                    cycle_toggle_state(toggle);
-                    if (try_display_state) draw_ToggleMenu_states(state_win, toggle_menu);
-                }
+/*
+ * Reads a menu description from in, in a single pass, and returns its toggles. One toggle per line:
+ *   bool on|off [locked] label
+ *   multi current/num_states [locked] label
+ *   text max_size [locked] label
+ * Blank lines and lines starting with '#' are skipped. TextFields get the passed geometry and the default linters.
+ * The Toggle array, labels and TextFields all come from arena, so size its blocks after the input to load it with a
+ * single malloc. Pass the result to new_ToggleMenu(): free_ToggleMenu() closes the TextFields, then the arena
+ * releases the memory.
+ * Returns NULL when in is malformed, with *error_line set to its first bad line.
+ * *error_line is 0 instead when in has no toggles, or reading or allocating failed.
+ */
+Toggle* load_ToggleMenu_toggles(FILE* in, S4C_Gui_Arena* arena, int txt_height, int txt_width, int txt_start_x, int txt_start_y, int* num_toggles, int* error_line)
+{
+    assert(in!=NULL);
+    assert(arena!=NULL);
+    assert(num_toggles!=NULL);
+    *num_toggles = 0;
+    if (error_line != NULL) *error_line = 0;
+    ToggleMenu_Load_Chunk* first = NULL;
+    ToggleMenu_Load_Chunk* last = NULL;
+    int count = 0;
+    int line_num = 0;
+    int bad_line = 0;
+    bool failed = false;
+    char line[TOGGLEMENU_LOAD_LINE_MAX];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        line_num++;
+        size_t len = strlen(line);
+        if (len > 0 && line[len-1] == '\n') {
+            line[--len] = '\0';
+        } else if (!feof(in)) {
+            // Too long for the buffer
+            bad_line = line_num;
+            break;
+        }
+        while (len > 0 && (line[len-1] == '\r' || line[len-1] == ' ' || line[len-1] == '\t')) line[--len] = '\0';
+        char* start = line;
+        while (*start == ' ' || *start == '\t') start++;
+        if (*start == '\0' || *start == '#') continue;
+
+        if (last == NULL || last->count == TOGGLEMENU_LOAD_CHUNK) {
+            ToggleMenu_Load_Chunk* chunk = alloc_S4C_Gui_Arena(arena, sizeof(ToggleMenu_Load_Chunk));
+            if (chunk == NULL) {
+                failed = true;
+                break;
             }
-        } else if ( toggle_menu.get_mouse_events && (c == KEY_MOUSE) ) {
-            MEVENT mouse_event;
-            if (getmouse(&mouse_event) == OK) {
-                if (wenclose(menu_win, mouse_event.y, mouse_event.x) == TRUE) {
-                    assert(toggle_menu.mouse_handler != NULL);
-                    toggle_menu.mouse_handler(toggle_menu, &mouse_event);
-                }
+            chunk->next = NULL;
+            chunk->count = 0;
+            if (last != NULL) {
+                last->next = chunk;
             } else {
-                //TODO: handle this failure somehow
-                endwin();
-                fprintf(stderr,"\n[DEBUG] %s():    Failed getmouse().\n", __func__);
-                napms(2000);
-                refresh();
-            }
-        } else if ( c == '\n') {
-            // Toggle state for selected BOOL_TOGGLE item
-            if (current_item(nc_menu)) {
-                Toggle *toggle = (Toggle *)item_userptr(current_item(nc_menu));
-                if (toggle && toggle->type == BOOL_TOGGLE && !toggle->locked) {
-                    toggle->state.bool_state = !toggle->state.bool_state;
-                    draw_ToggleMenu_states(state_win, toggle_menu);
-                } else if (toggle && toggle->type == TEXTFIELD_TOGGLE && !toggle->locked) {
-                    use_clean_TextField(toggle->state.txt_state);
-                    if (try_display_state) draw_ToggleMenu_states(state_win, toggle_menu);
-                }
+                first = chunk;
             }
+            last = chunk;
+        }
+        if (count == INT_MAX || !parse_ToggleMenu_load_line(start, &(last->toggles[last->count]), arena, txt_height, txt_width, txt_start_x, txt_start_y)) {
+            bad_line = line_num;
+            break;
         }
+        last->count++;
+        count++;
     }
+    if (ferror(in)) failed = true;
 
-    // Clean up
-    unpost_menu(nc_menu);
-    free_menu(nc_menu);
-    for (int i = 0; i < num_toggles; i++) {
-        free_item(toggle_items[i]);
+    // Now that the count is known, lay the toggles out contiguously
+    Toggle* res = NULL;
+    if (!failed && bad_line == 0 && count > 0) {
+        res = alloc_S4C_Gui_Arena(arena, (size_t) count * sizeof(Toggle));
+        if (res == NULL) failed = true;
+    }
+    int i = 0;
+    for (ToggleMenu_Load_Chunk* chunk = first; chunk != NULL; chunk = chunk->next) {
+        if (res != NULL) {
+            memcpy(res + i, chunk->toggles, chunk->count * sizeof(Toggle));
+            i += chunk->count;
+            continue;
+        }
+        // Close the windows of the TextFields already made
+        for (int j = 0; j < chunk->count; j++) {
+            if (chunk->toggles[j].type == TEXTFIELD_TOGGLE) free_TextField(chunk->toggles[j].state.txt_state);
+        }
+    }
+    if (res == NULL) {
+        if (error_line != NULL) *error_line = bad_line;
+        return NULL;
     }
-    free(toggle_items);
-    delwin(menu_win);
-    if (try_display_state) delwin(state_win);
+    *num_toggles = count;
+    return res;
 }
 // }
 // TOGGLE_H_
+
+#ifndef S4C_GUI_TERM_H_
+#error "This should not happen. S4C_GUI_TERM_H_ is defined in s4c_gui.h"
+#endif // S4C_GUI_TERM_H_
+
+#define S4C_GUI_TERM_PUMP_MSECS 20 // How long the proxy pump waits for output before checking the terminal size
+
+static S4C_Gui_Term* s4c_gui_current_term = NULL;
+
+#ifndef _WIN32
+/*
+ * Pty standing between ncurses and the real terminal for metered terminals.
+ * ncurses writes to the slave side; what comes out of the master side is accounted, then copied to the sink.
+ */
+struct S4C_Gui_Term_Proxy {
+    int master;
+    FILE* slave;
+    int sink;
+    pthread_t pump;
+    pthread_mutex_t lock;
+    bool stop;
+    S4C_Gui_Widget widget; // Widget the pump accounts output to
+    size_t bytes; // Total forwarded to the sink
+    struct winsize size;
+    int in_fd; // Real terminal modes to restore, -1 when untouched
+    struct termios in_modes;
+    int out_fd;
+    struct termios out_modes;
+};
+
+static void write_S4C_Gui_Term_sink(int fd, const char* buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return;
+        }
+        buf += written;
+        len -= written;
+    }
+}
+
+/*
+ * Moves everything available on the master side to the sink. Callers hold proxy->lock.
+ */
+static void drain_S4C_Gui_Term_Proxy(struct S4C_Gui_Term_Proxy* proxy, S4C_Gui_Widget widget)
+{
+    char buf[4096];
+    ssize_t len = 0;
+    while ((len = read(proxy->master, buf, sizeof(buf))) > 0) {
+        if (s4c_gui_stats_enabled) count_s4c_gui_output(widget, buf, len);
+        proxy->bytes += len;
+        write_S4C_Gui_Term_sink(proxy->sink, buf, len);
+    }
+}
+
+/*
+ * Forwards output the library did not flush itself, like a refresh() from the caller,
+ * and keeps the pty size in step with the real terminal.
+ */
+static void* pump_S4C_Gui_Term_Proxy(void* arg)
+{
+    struct S4C_Gui_Term_Proxy* proxy = arg;
+    struct pollfd pfd = { .fd = proxy->master, .events = POLLIN };
+    for (;;) {
+        poll(&pfd, 1, S4C_GUI_TERM_PUMP_MSECS);
+        pthread_mutex_lock(&proxy->lock);
+        if (proxy->stop) {
+            pthread_mutex_unlock(&proxy->lock);
+            return NULL;
+        }
+        drain_S4C_Gui_Term_Proxy(proxy, proxy->widget);
+        struct winsize size = {0};
+        if (ioctl(proxy->sink, TIOCGWINSZ, &size) == 0 && (size.ws_row != proxy->size.ws_row || size.ws_col != proxy->size.ws_col)) {
+            proxy->size = size;
+            ioctl(fileno(proxy->slave), TIOCSWINSZ, &size);
+        }
+        pthread_mutex_unlock(&proxy->lock);
+    }
+}
+#endif // _WIN32
+
+static bool begin_S4C_Gui_Term_output(S4C_Gui_Widget widget)
+{
+    S4C_Gui_Term* term = s4c_gui_current_term;
+    if (term == NULL) return false;
+#ifndef _WIN32
+    if (term->proxy != NULL) {
+        pthread_mutex_lock(&term->proxy->lock);
+        term->proxy->widget = widget;
+        pthread_mutex_unlock(&term->proxy->lock);
+        return true;
+    }
+#endif // _WIN32
+    return (lseek(fileno(term->out), 0, SEEK_CUR) >= 0);
+}
+
+/*
+ * Accounts to widget the output sent since the last call.
+ * For seekable outputs it's read back to count escape sequences, when out was opened for reading.
+ */
+static void end_S4C_Gui_Term_output(S4C_Gui_Widget widget)
+{
+    S4C_Gui_Term* term = s4c_gui_current_term;
+    if (term == NULL) return;
+#ifndef _WIN32
+    if (term->proxy != NULL) {
+        pthread_mutex_lock(&term->proxy->lock);
+        drain_S4C_Gui_Term_Proxy(term->proxy, widget);
+        term->proxy->widget = S4C_GUI_WIDGET_OTHER;
+        pthread_mutex_unlock(&term->proxy->lock);
+        return;
+    }
+#endif // _WIN32
+    int fd = fileno(term->out);
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos <= term->out_pos) return;
+    char buf[4096];
+    while (term->out_pos < pos) {
+        size_t len = (pos - term->out_pos < (off_t) sizeof(buf) ? (size_t) (pos - term->out_pos) : sizeof(buf));
+#ifndef _WIN32
+        ssize_t got = pread(fd, buf, len, term->out_pos);
+#else
+        ssize_t got = -1;
+#endif // _WIN32
+        if (got <= 0) {
+            // Write-only output: bytes are still known, escapes are not
+            s4c_gui_stats.widgets[widget].bytes += pos - term->out_pos;
+            s4c_gui_stats.bytes += pos - term->out_pos;
+            break;
+        }
+        count_s4c_gui_output(widget, buf, got);
+        term->out_pos += got;
+    }
+    term->out_pos = pos;
+}
+
+static void lock_S4C_Gui_Term_output(bool lock)
+{
+#ifndef _WIN32
+    S4C_Gui_Term* term = s4c_gui_current_term;
+    if (term == NULL || term->proxy == NULL) return;
+    if (lock) {
+        pthread_mutex_lock(&term->proxy->lock);
+    } else {
+        pthread_mutex_unlock(&term->proxy->lock);
+    }
+#else
+    (void) lock;
+#endif // _WIN32
+}
+
+/*
+ * Returns the file descriptor input is read from: the current S4C_Gui_Term's one, or stdin.
+ * Add it to a poll() set and call the step functions when it's readable.
+ */
+int get_s4c_gui_input_fd(void)
+{
+    if (s4c_gui_current_term != NULL) return fileno(s4c_gui_current_term->in);
+    return fileno(stdin);
+}
+
+/*
+ * Returns a terminal drawing to out and reading from in, then makes it the current one.
+ * out can be a regular file or a pty. When in is NULL, input comes from the null device and reads as EOF.
+ * term_type defaults to "xterm". The screen is resized to rows x cols when both are positive.
+ */
+S4C_Gui_Term* new_S4C_Gui_Term_headless(const char* term_type, FILE* out, FILE* in, int rows, int cols)
+{
+    assert(out!=NULL);
+    S4C_Gui_Term* res = s4c_gui_inner_calloc(1, sizeof(S4C_Gui_Term));
+    if (res == NULL) return NULL;
+    res->out = out;
+    res->in = in;
+    if (in == NULL) {
+#ifdef _WIN32
+        res->in = fopen("NUL", "r");
+#else
+        res->in = fopen("/dev/null", "r");
+#endif
+        res->owns_in = true;
+        if (res->in == NULL) {
+            s4c_gui_inner_free(res);
+            return NULL;
+        }
+    }
+    res->screen = newterm((term_type != NULL ? term_type : "xterm"), res->out, res->in);
+    if (res->screen == NULL) {
+        if (res->owns_in) fclose(res->in);
+        s4c_gui_inner_free(res);
+        return NULL;
+    }
+    set_term(res->screen);
+    if (rows > 0 && cols > 0) {
+        resizeterm(rows, cols);
+        // Drop the KEY_RESIZE queued by resizeterm(), so scripted input starts clean
+        flushinp();
+    }
+    res->out_pos = lseek(fileno(res->out), 0, SEEK_CUR);
+    s4c_gui_current_term = res;
+    return res;
+}
+
+#ifndef _WIN32
+/*
+ * Saves the terminal modes of fd in saved, then applies them with the given flags cleared.
+ * Returns fd, or -1 when fd is not a terminal.
+ */
+static int set_S4C_Gui_Term_modes(int fd, struct termios* saved, tcflag_t lflags, tcflag_t oflags)
+{
+    if (!isatty(fd) || tcgetattr(fd, saved) != 0) return -1;
+    struct termios modes = *saved;
+    modes.c_lflag &= ~lflags;
+    modes.c_oflag &= ~oflags;
+    modes.c_cc[VMIN] = 1;
+    modes.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &modes);
+    return fd;
+}
+
+static void free_S4C_Gui_Term_Proxy(struct S4C_Gui_Term_Proxy* proxy)
+{
+    pthread_mutex_lock(&proxy->lock);
+    proxy->stop = true;
+    pthread_mutex_unlock(&proxy->lock);
+    pthread_join(proxy->pump, NULL);
+    drain_S4C_Gui_Term_Proxy(proxy, S4C_GUI_WIDGET_OTHER);
+    if (proxy->out_fd >= 0) tcsetattr(proxy->out_fd, TCSANOW, &proxy->out_modes);
+    if (proxy->in_fd >= 0) tcsetattr(proxy->in_fd, TCSANOW, &proxy->in_modes);
+    pthread_mutex_destroy(&proxy->lock);
+    fclose(proxy->slave);
+    close(proxy->master);
+    s4c_gui_inner_free(proxy);
+}
+
+/*
+ * Returns a terminal drawing to out through a pty, so every byte sent can be accounted even on a live TTY.
+ * out and in default to stdout and stdin, term_type to $TERM. Makes it the current terminal.
+ * The real terminal is put in non canonical, no echo mode until free_S4C_Gui_Term(): mode changes
+ * requested from ncurses, like raw(), only apply to the pty.
+ */
+S4C_Gui_Term* new_S4C_Gui_Term_metered(const char* term_type, FILE* out, FILE* in)
+{
+    if (out == NULL) out = stdout;
+    if (in == NULL) in = stdin;
+    if (term_type == NULL) term_type = getenv("TERM");
+    if (term_type == NULL) term_type = "xterm";
+    fflush(out);
+
+    S4C_Gui_Term* res = s4c_gui_inner_calloc(1, sizeof(S4C_Gui_Term));
+    struct S4C_Gui_Term_Proxy* proxy = s4c_gui_inner_calloc(1, sizeof(struct S4C_Gui_Term_Proxy));
+    if (res == NULL || proxy == NULL) {
+        s4c_gui_inner_free(proxy);
+        s4c_gui_inner_free(res);
+        return NULL;
+    }
+    proxy->master = posix_openpt(O_RDWR | O_NOCTTY);
+    int slave = -1;
+    if (proxy->master < 0 || grantpt(proxy->master) != 0 || unlockpt(proxy->master) != 0
+        || (slave = open(ptsname(proxy->master), O_RDWR | O_NOCTTY)) < 0
+        || (proxy->slave = fdopen(slave, "w")) == NULL) {
+        if (slave >= 0) close(slave);
+        if (proxy->master >= 0) close(proxy->master);
+        s4c_gui_inner_free(proxy);
+        s4c_gui_inner_free(res);
+        return NULL;
+    }
+    fcntl(proxy->master, F_SETFL, fcntl(proxy->master, F_GETFL) | O_NONBLOCK);
+    proxy->sink = fileno(out);
+    if (ioctl(proxy->sink, TIOCGWINSZ, &proxy->size) == 0) {
+        ioctl(slave, TIOCSWINSZ, &proxy->size);
+    }
+    // Output was already processed by the pty: the real terminal must pass it through
+    proxy->in_fd = set_S4C_Gui_Term_modes(fileno(in), &proxy->in_modes, ICANON | ECHO, (fileno(in) == proxy->sink ? OPOST : 0));
+    proxy->out_fd = (fileno(in) == proxy->sink ? -1 : set_S4C_Gui_Term_modes(proxy->sink, &proxy->out_modes, 0, OPOST));
+    proxy->widget = S4C_GUI_WIDGET_OTHER;
+    pthread_mutex_init(&proxy->lock, NULL);
+
+    res->out = out;
+    res->in = in;
+    res->proxy = proxy;
+    res->screen = newterm(term_type, proxy->slave, in);
+    if (res->screen == NULL || pthread_create(&proxy->pump, NULL, &pump_S4C_Gui_Term_Proxy, proxy) != 0) {
+        if (res->screen != NULL) delscreen(res->screen);
+        if (proxy->out_fd >= 0) tcsetattr(proxy->out_fd, TCSANOW, &proxy->out_modes);
+        if (proxy->in_fd >= 0) tcsetattr(proxy->in_fd, TCSANOW, &proxy->in_modes);
+        pthread_mutex_destroy(&proxy->lock);
+        fclose(proxy->slave);
+        close(proxy->master);
+        s4c_gui_inner_free(proxy);
+        s4c_gui_inner_free(res);
+        return NULL;
+    }
+    set_term(res->screen);
+    s4c_gui_current_term = res;
+    return res;
+}
+#endif // _WIN32
+
+/*
+ * Returns how many bytes were written to the terminal output so far.
+ * Only works for metered terminals and when out is seekable, such as a regular file: returns 0 otherwise.
+ */
+size_t get_S4C_Gui_Term_bytes(S4C_Gui_Term* term)
+{
+    assert(term!=NULL);
+#ifndef _WIN32
+    if (term->proxy != NULL) {
+        pthread_mutex_lock(&term->proxy->lock);
+        size_t res = term->proxy->bytes;
+        pthread_mutex_unlock(&term->proxy->lock);
+        return res;
+    }
+#endif // _WIN32
+    off_t pos = lseek(fileno(term->out), 0, SEEK_CUR);
+    return (pos > 0 ? (size_t) pos : 0);
+}
+
+void free_S4C_Gui_Term(S4C_Gui_Term* term)
+{
+    if (term == NULL) return;
+    if (s4c_gui_current_term == term) s4c_gui_current_term = NULL;
+    set_term(term->screen);
+    endwin();
+    if (s4c_gui_input_pad_screen == curscr) {
+        // Freed with the screen
+        s4c_gui_input_pad = NULL;
+        s4c_gui_input_pad_screen = NULL;
+    }
+    if (s4c_gui_win_pool_screen == curscr) {
+        s4c_gui_win_pool_len = 0;
+        s4c_gui_win_pool_screen = NULL;
+    }
+    delscreen(term->screen);
+#ifndef _WIN32
+    if (term->proxy != NULL) free_S4C_Gui_Term_Proxy(term->proxy);
+#endif // _WIN32
+    if (term->owns_in) fclose(term->in);
+    s4c_gui_inner_free(term);
+}
@@ -17,6 +17,7 @@
 */
 #ifndef S4C_GUI_H_
 #define S4C_GUI_H_
+#include <stdbool.h>
 #include <stdlib.h>
 
 /**
@@ -33,6 +34,13 @@
 #define S4C_GUI_CALLOC calloc
 #endif // S4C_GUI_CALLOC
 
+/**
+ * Function name to use in place of free.
+ */
+#ifndef S4C_GUI_FREE
+#define S4C_GUI_FREE free
+#endif // S4C_GUI_FREE
+
 #define S4C_GUI_MAJOR 0 /**< Represents current major release.*/
 #define S4C_GUI_MINOR 0 /**< Represents current minor release.*/
 #define S4C_GUI_PATCH 8 /**< Represents current patch release.*/
@@ -64,6 +72,169 @@ typedef void(s4c_gui_free_func)(void* obj); /**< Used to select a free function.
 
 extern s4c_gui_malloc_func* s4c_gui_inner_malloc;
 extern s4c_gui_calloc_func* s4c_gui_inner_calloc;
+extern s4c_gui_free_func* s4c_gui_inner_free;
+
+typedef void*(s4c_gui_ctx_alloc_func)(void* ctx, size_t size); /**< Used to select an allocation function taking a context.*/
+typedef void(s4c_gui_ctx_free_func)(void* ctx, void* obj); /**< Used to select a free function taking a context.*/
+
+/**
+ * Allocator interface carrying a context pointer, which is passed back on every call.
+ * A NULL free function means memory is released all at once by whoever owns the context.
+ */
+typedef struct S4C_Gui_Allocator {
+    void* ctx;
+    s4c_gui_ctx_alloc_func* alloc;
+    s4c_gui_ctx_free_func* free;
+} S4C_Gui_Allocator;
+
+/**
+ * Allocator using s4c_gui_inner_malloc and s4c_gui_inner_free.
+ */
+extern const S4C_Gui_Allocator s4c_gui_default_allocator;
+
+/**
+ * Alignment for memory handed out by S4C_Gui_Arena.
+ */
+#ifndef S4C_GUI_ARENA_ALIGN
+#define S4C_GUI_ARENA_ALIGN 16
+#endif // S4C_GUI_ARENA_ALIGN
+
+typedef struct S4C_Gui_Arena_Block S4C_Gui_Arena_Block;
+
+/**
+ * Bump allocator. Hands out memory from contiguous blocks and only releases it all at once.
+ * When the current block is full, a new one at least as big is chained to it.
+ */
+typedef struct S4C_Gui_Arena {
+    S4C_Gui_Arena_Block* head; // Block currently being used
+    size_t block_size;
+    size_t total_allocs;
+} S4C_Gui_Arena;
+
+S4C_Gui_Arena* new_S4C_Gui_Arena(size_t block_size);
+void* alloc_S4C_Gui_Arena(void* arena, size_t size);
+void reset_S4C_Gui_Arena(S4C_Gui_Arena* arena);
+void free_S4C_Gui_Arena(S4C_Gui_Arena* arena);
+S4C_Gui_Allocator get_S4C_Gui_Arena_allocator(S4C_Gui_Arena* arena);
+
+/**
+ * Widgets whose terminal output is accounted separately.
+ * Output flushed outside of the library, like a refresh() from the caller, goes to S4C_GUI_WIDGET_OTHER.
+ */
+typedef enum S4C_Gui_Widget {
+    S4C_GUI_WIDGET_OTHER = 0,
+    S4C_GUI_WIDGET_TEXTFIELD,
+    S4C_GUI_WIDGET_MENU,
+    S4C_GUI_WIDGET_STATEWIN,
+    S4C_GUI_WIDGET_TEXTAREA,
+} S4C_Gui_Widget;
+
+#define S4C_GUI_WIDGET_MAX S4C_GUI_WIDGET_TEXTAREA
+
+/**
+ * Drawing operations counted per widget. Only calls are counted: curses merges them all into the frame it sends,
+ * so no bytes can be told apart per operation.
+ */
+typedef enum S4C_Gui_Op {
+    S4C_GUI_OP_CLEAR = 0, // wclear(), werase()
+    S4C_GUI_OP_BOX, // box()
+    S4C_GUI_OP_PRINT, // mvwprintw(), waddch(), mvwhline()
+} S4C_Gui_Op;
+
+#define S4C_GUI_OP_MAX S4C_GUI_OP_PRINT
+
+typedef struct S4C_Gui_Widget_Stats {
+    size_t refreshes;
+    size_t bytes; // Share of each frame's bytes, split by the lines the widget staged for it
+    size_t escapes; // Escape sequences, counted by their leading ESC
+    size_t ops[S4C_GUI_OP_MAX+1]; // Calls made, not bytes
+} S4C_Gui_Widget_Stats;
+
+/**
+ * Terminal output accounting, from the last reset_s4c_gui_output_stats() call.
+ * Bytes are only measured on terminals from new_S4C_Gui_Term_headless() with a seekable output
+ * and on terminals from new_S4C_Gui_Term_metered(): bytes_measured is false otherwise.
+ */
+typedef struct S4C_Gui_Output_Stats {
+    S4C_Gui_Widget_Stats widgets[S4C_GUI_WIDGET_MAX+1];
+    size_t refreshes;
+    size_t deferred; // Flushes folded into a later frame by the frame rate cap
+    size_t bytes;
+    size_t escapes;
+    bool bytes_measured;
+} S4C_Gui_Output_Stats;
+
+/**
+ * Result of a step function, which handles the input that is ready and returns.
+ */
+typedef enum S4C_Gui_Step {
+    S4C_GUI_STEP_CONTINUE = 0, // Waiting for more input
+    S4C_GUI_STEP_DONE, // Widget is done: Enter for a TextField, the quit key for a ToggleMenu
+    S4C_GUI_STEP_EOF, // A blocking read failed, input is gone
+} S4C_Gui_Step;
+
+int get_s4c_gui_input_fd(void);
+
+/**
+ * Max timers pending at once.
+ */
+#ifndef S4C_GUI_TIMERS_MAX
+#define S4C_GUI_TIMERS_MAX 16
+#endif // !S4C_GUI_TIMERS_MAX
+
+/**
+ * Max released windows kept for reuse: TextFields only hold a window from when they're drawn to when they're closed.
+ */
+#ifndef S4C_GUI_WIN_POOL_MAX
+#define S4C_GUI_WIN_POOL_MAX 4
+#endif // !S4C_GUI_WIN_POOL_MAX
+
+typedef void(S4C_Gui_Timer_Handler)(void* arg);
+
+int add_s4c_gui_timer(int msecs, S4C_Gui_Timer_Handler* handler, void* arg);
+void cancel_s4c_gui_timer(int timer);
+int get_s4c_gui_timers_timeout(void);
+int fire_s4c_gui_timers(void);
+int show_s4c_gui_notice(int y, int x, const char* msg, int msecs);
+
+/**
+ * Default cap on frames sent to the terminal per second, 0 for no cap.
+ * Flushes coming sooner from a step loop, like step_TextField() or handle_ToggleMenu(), are folded into one frame
+ * sent by a timer when the frame is due. Drawing functions called outside of one always send their frame right away.
+ */
+#ifndef S4C_GUI_MAX_FPS
+#define S4C_GUI_MAX_FPS 60
+#endif // !S4C_GUI_MAX_FPS
+
+void set_s4c_gui_max_fps(int fps);
+void flush_s4c_gui_frame(void);
+
+/**
+ * Version of the files written by start_s4c_gui_recording(). Files of other versions are refused.
+ */
+#define S4C_GUI_RECORDING_VERSION 1
+
+/**
+ * Progress of a replay from start_s4c_gui_replay(), and the input to screen latency of the events it fed.
+ */
+typedef struct S4C_Gui_Replay_Stats {
+    size_t events; // Events fed so far
+    size_t events_left;
+    size_t frames; // Frames sent since the replay started
+    long long p50_usecs;
+    long long p99_usecs;
+    long long max_usecs;
+} S4C_Gui_Replay_Stats;
+
+bool start_s4c_gui_recording(const char* path);
+bool stop_s4c_gui_recording(void);
+bool start_s4c_gui_replay(const char* path, bool realtime);
+S4C_Gui_Replay_Stats get_s4c_gui_replay_stats(void);
+void stop_s4c_gui_replay(void);
+
+void enable_s4c_gui_output_stats(bool enabled);
+S4C_Gui_Output_Stats get_s4c_gui_output_stats(void);
+void reset_s4c_gui_output_stats(void);
 
 #ifndef TEXT_FIELD_H_
 #define TEXT_FIELD_H_
@@ -90,12 +261,84 @@ extern TextField_Linter* default_linters[TEXTFIELD_DEFAULT_LINTERS_TOT+1];
 
 extern const void* default_linter_args[TEXTFIELD_DEFAULT_LINTERS_TOT+1];
 
+/**
+ * How long warn_TextField() shows its message, unless a key is pressed first.
+ */
+#ifndef TEXTFIELD_WARN_MSECS
+#define TEXTFIELD_WARN_MSECS 500
+#endif // !TEXTFIELD_WARN_MSECS
+
 void warn_TextField(TextField txt);
 bool lint_TextField_not_empty(TextField txt, const void* unused);
 bool lint_TextField_equals_cstr(TextField txt, const void* cstr);
 bool lint_TextField_whitelist(TextField txt, const void* whitelist);
 bool lint_TextField_digits_only(TextField txt);
 bool lint_TextField_chars_only(TextField txt);
+
+#ifndef TEXTFIELD_CHARCLASS_MAX_RANGES
+#define TEXTFIELD_CHARCLASS_MAX_RANGES 4
+#endif // !TEXTFIELD_CHARCLASS_MAX_RANGES
+
+/**
+ * Character class compiled into a 256-bit bitmap, one bit per byte value.
+ * Compile it once, then pass a pointer to it as the linter arg for lint_TextField_charclass().
+ */
+typedef struct TextField_CharClass {
+    unsigned char bits[32];
+    unsigned char ranges[TEXTFIELD_CHARCLASS_MAX_RANGES][2]; // Inclusive runs of set bits, used by the SSE2 kernel
+    int num_ranges; // -1 when the class has more runs than TEXTFIELD_CHARCLASS_MAX_RANGES
+} TextField_CharClass;
+
+TextField_CharClass compile_TextField_CharClass_whitelist(const char* chars);
+TextField_CharClass compile_TextField_CharClass_blacklist(const char* chars);
+TextField_CharClass compile_TextField_CharClass_range(int min, int max);
+TextField_CharClass compile_TextField_CharClass_spec(const char* spec);
+size_t scan_TextField_CharClass(const TextField_CharClass* charclass, const char* buf, size_t len);
+bool lint_TextField_charclass(TextField txt, const void* charclass);
+
+typedef struct TextField_Length_Range {
+    int min;
+    int max;
+} TextField_Length_Range;
+
+bool lint_TextField_length_range(TextField txt, const void* range);
+
+/**
+ * Cached state for one linter of a TextField with live linting on.
+ */
+typedef struct TextField_IncLint_State {
+    const struct TextField_IncLinter* inc; // NULL when the linter has no incremental version
+    size_t count; // Meaning depends on the linter
+    size_t aux; // Meaning depends on the linter
+    bool stale; // Must be rebuilt from the buffer before use
+} TextField_IncLint_State;
+
+/**
+ * Incremental version of a TextField_Linter.
+ * push and pop are called for each char inserted or removed at pos, after length was updated, and may be NULL.
+ * verdict must give the same result as the mirrored linter, in O(1).
+ * Set append_only when push/pop are only correct for edits at the end of the buffer: other edits mark the state stale.
+ */
+typedef struct TextField_IncLinter {
+    TextField_Linter* linter;
+    void (*reset)(TextField_IncLint_State* state, const void* args);
+    void (*push)(TextField_IncLint_State* state, const void* args, char ch, int pos);
+    void (*pop)(TextField_IncLint_State* state, const void* args, char ch, int pos);
+    bool (*verdict)(const TextField_IncLint_State* state, const void* args, int length);
+    bool append_only;
+} TextField_IncLinter;
+
+#ifndef TEXTFIELD_INCLINTERS_MAX
+#define TEXTFIELD_INCLINTERS_MAX 16
+#endif // !TEXTFIELD_INCLINTERS_MAX
+
+typedef void(TextField_Lint_Handler)(TextField, bool passing);
+
+bool register_TextField_IncLinter(const TextField_IncLinter* inc_linter);
+void enable_TextField_live_lint(TextField txt, TextField_Lint_Handler* handler);
+void disable_TextField_live_lint(TextField txt);
+bool lint_TextField_cached(TextField txt);
+void show_TextField_lint(TextField txt, bool passing);
 TextField new_TextField_(TextField_Full_Handler* full_buffer_handler, TextField_Linter** linters, size_t num_linters, const void** linter_args, size_t max_size, int height, int width, int start_x, int start_y, const char* prompt, s4c_gui_malloc_func* malloc_func, s4c_gui_calloc_func* calloc_func, s4c_gui_free_func* free_func);
 TextField new_TextField_centered_(TextField_Full_Handler* full_buffer_handler, TextField_Linter** linters, size_t num_linters, const void** linter_args, size_t max_size, int height, int width, int bound_x, int bound_y, const char* prompt, s4c_gui_malloc_func* malloc_func, s4c_gui_calloc_func* calloc_func, s4c_gui_free_func* free_func);
 bool lint_TextField(TextField txt_field);
@@ -103,13 +346,61 @@ TextField new_TextField(size_t max_size, int height, int width, int start_x, int
 TextField new_TextField_centered(size_t max_size, int height, int width, int bound_x, int bound_y);
 TextField new_TextField_linted(TextField_Linter** linters, size_t num_linters, const void** linter_args, size_t max_size, int height, int width, int start_x, int start_y);
 TextField new_TextField_alloc(size_t max_size, int height, int width, int start_x, int start_y, s4c_gui_malloc_func* malloc_func, s4c_gui_calloc_func* calloc_func, s4c_gui_free_func* free_func);
+TextField new_TextField_with_allocator(TextField_Full_Handler* full_buffer_handler, TextField_Linter** linters, size_t num_linters, const void** linter_args, size_t max_size, int height, int width, int start_x, int start_y, const char* prompt, S4C_Gui_Allocator allocator);
 void draw_TextField(TextField txt);
 void clear_TextField(TextField txt);
+bool set_TextField_value(TextField txt, const char* value, int len);
+/**
+ * Most pending input characters read in one pass, like a paste, before the TextField window is refreshed.
+ */
+#ifndef TEXTFIELD_INPUT_BURST_MAX
+#define TEXTFIELD_INPUT_BURST_MAX 512
+#endif // !TEXTFIELD_INPUT_BURST_MAX
+
+void open_TextField(TextField txt_field);
+S4C_Gui_Step step_TextField(TextField txt_field, int timeout);
+void close_TextField(TextField txt_field);
 void use_clean_TextField(TextField txt_field);
 void free_TextField(TextField txt_field);
 const char* get_TextField_value(TextField txt_field);
 int get_TextField_len(TextField txt_field);
 WINDOW* get_TextField_win(TextField txt_field);
+
+/**
+ * Multi-line sibling of TextField. Text is kept in a piece table over a borrowed original text and an append-only add buffer,
+ * with an index of newline offsets for O(log n) line lookup. Only the rows in view are drawn.
+ */
+typedef struct TextArea_s *TextArea;
+
+typedef void(TextArea_Full_Handler)(TextArea);
+
+typedef bool(TextArea_Linter)(TextArea, const void*);
+
+/**
+ * Key ending input in a TextArea, since Enter inserts a newline. Defaults to Ctrl-D.
+ */
+#ifndef TEXTAREA_DONE_KEY
+#define TEXTAREA_DONE_KEY 4
+#endif // !TEXTAREA_DONE_KEY
+
+void warn_TextArea(TextArea area);
+bool lint_TextArea_not_empty(TextArea area, const void* unused);
+bool lint_TextArea_charclass(TextArea area, const void* charclass);
+bool lint_TextArea_length_range(TextArea area, const void* range);
+TextArea new_TextArea_(TextArea_Full_Handler* full_buffer_handler, TextArea_Linter** linters, size_t num_linters, const void** linter_args, size_t max_size, int height, int width, int start_x, int start_y, const char* prompt);
+TextArea new_TextArea(size_t max_size, int height, int width, int start_x, int start_y);
+bool set_TextArea_text(TextArea area, const char* text, size_t len);
+bool lint_TextArea(TextArea area);
+void draw_TextArea(TextArea area);
+void open_TextArea(TextArea area);
+S4C_Gui_Step step_TextArea(TextArea area, int timeout);
+void close_TextArea(TextArea area);
+void use_clean_TextArea(TextArea area);
+void free_TextArea(TextArea area);
+const char* get_TextArea_value(TextArea area);
+size_t get_TextArea_len(TextArea area);
+size_t get_TextArea_lines(TextArea area);
+WINDOW* get_TextArea_win(TextArea area);
 #endif // TEXT_FIELD_H_
 
 #ifndef TOGGLE_H_
@@ -124,6 +415,8 @@ WINDOW* get_TextField_win(TextField txt_field);
 #endif
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
 
 #ifndef TEXT_FIELD_H_
 #error "This should not happen. TEXT_FIELD_H_ is defined in this same file."
@@ -152,8 +445,8 @@ typedef union ToggleState {
 typedef struct Toggle {
     ToggleType type;
     ToggleState state;
-    char *label;
-    bool locked; // Toggle lock
+    char *label; // Once in a ToggleMenu, call invalidate_ToggleMenu_toggle() after changing it
+    bool locked; // Toggle lock. Once in a ToggleMenu, call invalidate_ToggleMenu_toggle() after changing it
     ToggleMultiState_Formatter* multistate_formatter;
 } Toggle;
 
@@ -162,6 +455,124 @@ struct ToggleMenu;
 
 typedef void(ToggleMenu_MouseEvent_Handler)(struct ToggleMenu, MEVENT* event);
 
+/**
+ * What a key bound in a ToggleMenu_Keymap does.
+ */
+typedef enum ToggleMenu_Action {
+    TOGGLEMENU_ACTION_NONE = 0, // Unbound
+    TOGGLEMENU_ACTION_UP,
+    TOGGLEMENU_ACTION_DOWN,
+    TOGGLEMENU_ACTION_PAGE_UP,
+    TOGGLEMENU_ACTION_PAGE_DOWN,
+    TOGGLEMENU_ACTION_FIRST,
+    TOGGLEMENU_ACTION_LAST,
+    TOGGLEMENU_ACTION_CYCLE, // Next state of a MULTI_STATE_TOGGLE
+    TOGGLEMENU_ACTION_ACTIVATE, // Flip a BOOL_TOGGLE, edit a TEXTFIELD_TOGGLE
+    TOGGLEMENU_ACTION_MOUSE, // Read and handle a mouse event
+    TOGGLEMENU_ACTION_SEARCH, // Start a type-ahead search over the labels
+    TOGGLEMENU_ACTION_QUIT,
+    TOGGLEMENU_ACTION_USER, // Call the bound ToggleMenu_Key_Handler
+} ToggleMenu_Action;
+
+/**
+ * User action bound in a ToggleMenu_Keymap. Gets the selected toggle index, -1 when none is selected.
+ * Call mark_ToggleMenu_dirty() for toggles it changes, and invalidate_ToggleMenu_toggle() for the ones it relabels or locks.
+ */
+typedef void(ToggleMenu_Key_Handler)(struct ToggleMenu, int toggle_index, void* arg);
+
+/**
+ * Called when the terminal is resized, before the windows are moved. Can update the position and size fields from LINES and COLS.
+ * Windows that don't fit the new screen are shifted, then shrunk.
+ */
+typedef void(ToggleMenu_Resize_Handler)(struct ToggleMenu* toggle_menu);
+
+/**
+ * Compiled key bindings: a table indexed by key code, plus a trie for chords of more keys.
+ */
+typedef struct ToggleMenu_Keymap_s *ToggleMenu_Keymap;
+
+/**
+ * Sorted index of the words starting in each Toggle.label, for prefix search.
+ */
+typedef struct ToggleMenu_SearchIndex_s *ToggleMenu_SearchIndex;
+
+/**
+ * Cached widths of the labels and values in the state window, so its columns are placed without measuring every row.
+ */
+typedef struct ToggleMenu_Layout_s *ToggleMenu_Layout;
+
+/**
+ * Toggles changed since the last batch, one bit each, plus the listeners the batches go to.
+ */
+typedef struct ToggleMenu_Changes_s *ToggleMenu_Changes;
+
+/**
+ * Toggles that changed, as passed to a ToggleMenu_Change_Handler. Walk them with next_ToggleMenu_change().
+ */
+typedef struct ToggleMenu_ChangeBatch {
+    const uint64_t* bits; // Bit i % 64 of word i / 64 is set when toggle i changed
+    int num_toggles;
+    int count; // Set bits
+} ToggleMenu_ChangeBatch;
+
+/**
+ * Gets the toggles changed by an input event, or since the last batch. The batch is only valid during the call.
+ * Toggles it changes itself are delivered with the next batch.
+ */
+typedef void(ToggleMenu_Change_Handler)(struct ToggleMenu toggle_menu, const ToggleMenu_ChangeBatch* batch, void* arg);
+
+/**
+ * Bounded lock-free queue of toggle values posted by other threads, applied by the thread handling the ToggleMenu.
+ * Posting wakes a ToggleMenu blocked waiting for input through a self-pipe.
+ */
+typedef struct ToggleMenu_UpdateQueue_s *ToggleMenu_UpdateQueue;
+
+#ifndef TOGGLEMENU_UPDATE_TEXT_MAX
+#define TOGGLEMENU_UPDATE_TEXT_MAX 64 // Longest TextField value posted at once, terminator included
+#endif // !TOGGLEMENU_UPDATE_TEXT_MAX
+
+#ifndef TOGGLEMENU_VALUE_MAX
+#define TOGGLEMENU_VALUE_MAX 64 // Longest formatted BOOL_TOGGLE or MULTI_STATE_TOGGLE value
+#endif // !TOGGLEMENU_VALUE_MAX
+
+#ifndef TOGGLEMENU_COLUMN_MAX
+#define TOGGLEMENU_COLUMN_MAX 256 // Widest a state window column gets, longer labels and values are cut there
+#endif // !TOGGLEMENU_COLUMN_MAX
+
+#ifndef TOGGLEMENU_SEARCH_MAX
+#define TOGGLEMENU_SEARCH_MAX 32 // Longest type-ahead query
+#endif // !TOGGLEMENU_SEARCH_MAX
+
+#ifndef TOGGLEMENU_CHORD_MAX
+#define TOGGLEMENU_CHORD_MAX 4 // Most keys in a chord
+#endif // !TOGGLEMENU_CHORD_MAX
+
+#ifndef TOGGLEMENU_DIRTY_MAX
+#define TOGGLEMENU_DIRTY_MAX 32
+#endif // !TOGGLEMENU_DIRTY_MAX
+
+/**
+ * Tracks which toggles need their state row repainted, or their label picked up again.
+ * Holds up to TOGGLEMENU_DIRTY_MAX toggle indexes, so its size does not depend on the number of toggles.
+ * Overflowing it turns into one holding every toggle, like a full repaint.
+ */
+typedef struct ToggleMenu_DirtySet {
+    int toggles[TOGGLEMENU_DIRTY_MAX];
+    int count;
+    bool all; // Full repaint requested
+} ToggleMenu_DirtySet;
+
+#ifndef TOGGLEMENU_VIRTUAL_DEFAULT_ROWS
+#define TOGGLEMENU_VIRTUAL_DEFAULT_ROWS 20
+#endif // !TOGGLEMENU_VIRTUAL_DEFAULT_ROWS
+
+/**
+ * How long ToggleMenu debug and error notices stay on screen.
+ */
+#ifndef TOGGLEMENU_NOTICE_MSECS
+#define TOGGLEMENU_NOTICE_MSECS 2000
+#endif // !TOGGLEMENU_NOTICE_MSECS
+
 
 // Reference: https://tldp.org/HOWTO/NCURSES-Programming-HOWTO/mouse.html
 #ifndef TOGGLEMENU_DEFAULT_MOUSEEVENTS_MASK
@@ -188,6 +599,10 @@ typedef struct ToggleMenu_Conf {
     bool get_mouse_events;
     mmask_t mouse_events_mask;
     ToggleMenu_MouseEvent_Handler* mouse_handler;
+    bool virtualized; // Only keep the visible rows alive. Uses height and width as the viewport size when set
+    ToggleMenu_Keymap keymap; // When NULL, the key_* and quit_key fields are used
+    ToggleMenu_Resize_Handler* resize_handler; // May be NULL
+    ToggleMenu_UpdateQueue updates; // May be NULL
 } ToggleMenu_Conf;
 
 typedef struct ToggleMenu {
@@ -212,6 +627,16 @@ typedef struct ToggleMenu {
     bool get_mouse_events;
     mmask_t mouse_events_mask;
     ToggleMenu_MouseEvent_Handler* mouse_handler;
+    ToggleMenu_DirtySet* dirty; // Rows to repaint in the state window
+    ToggleMenu_DirtySet* relabeled; // Toggles invalidated since the view was last shown
+    bool virtualized;
+    int first_visible; // Index of the first toggle in view
+    ToggleMenu_Keymap keymap; // Not owned. When NULL, one is built from the key_* and quit_key fields
+    ToggleMenu_SearchIndex search; // Filled on the first search. NULL when it couldn't be allocated
+    ToggleMenu_Layout layout; // Built with the menu, over the rows in view when virtualized. NULL when it couldn't be allocated
+    ToggleMenu_Resize_Handler* resize_handler; // May be NULL
+    ToggleMenu_Changes changes; // Built with the menu, its bitsets by the first listener. NULL when it couldn't be allocated
+    ToggleMenu_UpdateQueue updates; // Not owned. Drained while the menu is handled, may be NULL
 } ToggleMenu;
 
 #define ToggleMenu_Fmt "ToggleMenu {\n  num_toggles: %i\n  height: %i\n  width: %i\n  start_x: %i\n  start_y: %i\n  boxed: %s\n  quit_key: %i\n  statewin_width: %i\n  statewin_height: %i\n  statewin_start_x: %i\n  statewin_start_y: %i\n  statewin_boxed: %s\n  statewin_label: %s\n  key_up: %i\n  key_right: %i\n  key_down: %i\n  key_left: %i\n  get_mouse_events: %s\n"
@@ -223,9 +648,83 @@ ToggleMenu new_ToggleMenu_(Toggle* toggles, int num_toggles, ToggleMenu_Conf con
 ToggleMenu new_ToggleMenu(Toggle* toggles, int num_toggles);
 ToggleMenu new_ToggleMenu_with_mouse_mask(Toggle* toggles, int num_toggles, ToggleMenu_MouseEvent_Handler* mouse_events_handler, mmask_t mouse_events_mask);
 ToggleMenu new_ToggleMenu_with_mouse(Toggle* toggles, int num_toggles, ToggleMenu_MouseEvent_Handler* mouse_events_handler);
+ToggleMenu new_ToggleMenu_virtualized(Toggle* toggles, int num_toggles, int height, int width);
+void mark_ToggleMenu_dirty(ToggleMenu toggle_menu, int toggle_index);
+void mark_ToggleMenu_all_dirty(ToggleMenu toggle_menu);
+void invalidate_ToggleMenu_toggle(ToggleMenu toggle_menu, int toggle_index);
+bool add_ToggleMenu_listener(ToggleMenu toggle_menu, ToggleMenu_Change_Handler* handler, void* arg);
+void remove_ToggleMenu_listener(ToggleMenu toggle_menu, ToggleMenu_Change_Handler* handler, void* arg);
+void notify_ToggleMenu_changes(ToggleMenu toggle_menu);
+int next_ToggleMenu_change(const ToggleMenu_ChangeBatch* batch, int from);
+
+ToggleMenu_UpdateQueue new_ToggleMenu_UpdateQueue(int capacity);
+bool post_ToggleMenu_bool(ToggleMenu_UpdateQueue queue, int toggle_index, bool value);
+bool post_ToggleMenu_multi(ToggleMenu_UpdateQueue queue, int toggle_index, int current_state);
+bool post_ToggleMenu_text(ToggleMenu_UpdateQueue queue, int toggle_index, const char* text);
+int get_ToggleMenu_UpdateQueue_fd(ToggleMenu_UpdateQueue queue);
+int apply_ToggleMenu_updates(ToggleMenu toggle_menu);
+void free_ToggleMenu_UpdateQueue(ToggleMenu_UpdateQueue queue);
 void draw_ToggleMenu_states(WINDOW *win, ToggleMenu toggle_menu);
+void draw_ToggleMenu_dirty_states(WINDOW *win, ToggleMenu toggle_menu);
 void handle_ToggleMenu(ToggleMenu toggle_menu);
 void free_ToggleMenu(ToggleMenu toggle_menu);
+int find_ToggleMenu_label(ToggleMenu toggle_menu, const char* prefix, int from);
+
+ToggleMenu_Keymap new_ToggleMenu_Keymap(ToggleMenu toggle_menu);
+bool bind_ToggleMenu_Keymap(ToggleMenu_Keymap keymap, const int* keys, int num_keys, ToggleMenu_Action action, ToggleMenu_Key_Handler* handler, void* arg);
+void free_ToggleMenu_Keymap(ToggleMenu_Keymap keymap);
+
+typedef struct ToggleMenu_Session_s *ToggleMenu_Session;
+
+ToggleMenu_Session new_ToggleMenu_Session(ToggleMenu toggle_menu);
+void open_ToggleMenu_Session(ToggleMenu_Session session);
+void handle_ToggleMenu_Session(ToggleMenu_Session session);
+S4C_Gui_Step step_ToggleMenu_Session(ToggleMenu_Session session, int timeout);
+void close_ToggleMenu_Session(ToggleMenu_Session session);
+void free_ToggleMenu_Session(ToggleMenu_Session session);
+
+/**
+ * Version of the files written by save_ToggleMenu_state(). Files of other versions are refused.
+ */
+#define TOGGLEMENU_STATE_VERSION 1
+
+bool save_ToggleMenu_state(ToggleMenu toggle_menu, const char* path);
+bool apply_ToggleMenu_state(ToggleMenu toggle_menu, const void* data, size_t size);
+bool restore_ToggleMenu_state(ToggleMenu toggle_menu, const char* path);
+
+/**
+ * Longest line accepted by load_ToggleMenu_toggles(), newline included.
+ */
+#ifndef TOGGLEMENU_LOAD_LINE_MAX
+#define TOGGLEMENU_LOAD_LINE_MAX 512
+#endif // !TOGGLEMENU_LOAD_LINE_MAX
+
+Toggle* load_ToggleMenu_toggles(FILE* in, S4C_Gui_Arena* arena, int txt_height, int txt_width, int txt_start_x, int txt_start_y, int* num_toggles, int* error_line);
 #endif // TOGGLE_H_
 
+#ifndef S4C_GUI_TERM_H_
+#define S4C_GUI_TERM_H_
+
+#include <stdio.h>
+
+/**
+ * Terminal created with newterm(), so widgets can draw to a pty or a plain file instead of the controlling TTY.
+ */
+typedef struct S4C_Gui_Term {
+    SCREEN* screen;
+    FILE* out;
+    FILE* in;
+    bool owns_in; // in was opened by new_S4C_Gui_Term_headless()
+    long out_pos; // Output position at the last accounting, for seekable outputs
+    struct S4C_Gui_Term_Proxy* proxy; // Only set by new_S4C_Gui_Term_metered()
+} S4C_Gui_Term;
+
+S4C_Gui_Term* new_S4C_Gui_Term_headless(const char* term_type, FILE* out, FILE* in, int rows, int cols);
+#ifndef _WIN32
+S4C_Gui_Term* new_S4C_Gui_Term_metered(const char* term_type, FILE* out, FILE* in);
+#endif // _WIN32
+size_t get_S4C_Gui_Term_bytes(S4C_Gui_Term* term);
+void free_S4C_Gui_Term(S4C_Gui_Term* term);
+#endif // S4C_GUI_TERM_H_
+
 #endif // S4C_GUI_H_